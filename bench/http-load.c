@@ -0,0 +1,336 @@
+/*
+
+HTTP server load test.
+
+Starts the embedded server on a free port, with a handler that answers every
+request with a small fixed body, then drives it over loopback from client
+threads that each keep a share of the connections busy with keep-alive GETs
+(one request in flight per connection). The same load is run against each
+server backend in turn, and the results go to stdout as JSON, one run per
+backend:
+
+  snp-http-load [-c connections] [-t threads] [-d seconds]
+                [-b epoll|io_uring|all] > run.json
+
+Latency is from writing a request to reading the end of its response. The
+server's CPU time is its thread's alone, so cpu_us_per_request compares what
+each backend costs per request apart from the clients sharing the machine.
+
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <glib.h>
+#include <jansson.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http-server.h"
+
+static const char request[] = "GET /now-playing HTTP/1.1\r\n"
+                              "Host: localhost\r\n"
+                              "\r\n";
+static const char body[] = "{\"playing\":true}";
+
+static int handler(HttpRequest *req, HttpResponse *res, void *user_data) {
+  (void)req;
+  (void)user_data;
+  res->code = 200;
+  res->content_type = "application/json";
+  http_response_body(res, body, sizeof(body) - 1, NULL, NULL);
+  return 0;
+}
+
+typedef struct {
+  int fd;
+  gint64 sent_at;
+  /** Bytes of the current response read so far. */
+  size_t got;
+} LoadConn;
+
+typedef struct {
+  unsigned short port;
+  int n_conns;
+  gint64 deadline;
+
+  /** Latencies in microseconds, one per completed request. */
+  GArray *latencies;
+  int failed;
+} LoadWorker;
+
+/** Length of the response to `request`, which never changes. */
+static size_t response_len;
+
+static int load_connect(unsigned short port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  struct sockaddr_in address = {.sin_family = AF_INET,
+                                .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)},
+                                .sin_port = htons(port)};
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  int enable = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  return fd;
+}
+
+static int load_send(LoadConn *conn) {
+  conn->got = 0;
+  conn->sent_at = g_get_monotonic_time();
+  // a request this small always fits in an empty socket buffer
+  return write(conn->fd, request, sizeof(request) - 1) ==
+                 (ssize_t)sizeof(request) - 1
+             ? 0
+             : -1;
+}
+
+static void *load_worker(void *data) {
+  LoadWorker *w = data;
+  LoadConn *conns = calloc(w->n_conns, sizeof(LoadConn));
+  struct pollfd *fds = calloc(w->n_conns, sizeof(struct pollfd));
+  char buf[4096];
+
+  for (int i = 0; i < w->n_conns; i++) {
+    conns[i].fd = load_connect(w->port);
+    if (conns[i].fd < 0 || load_send(&conns[i]) < 0) {
+      perror("connect");
+      w->failed++;
+      conns[i].fd = -1;
+    }
+    fds[i].fd = conns[i].fd;
+    fds[i].events = POLLIN;
+  }
+
+  while (g_get_monotonic_time() < w->deadline) {
+    if (poll(fds, w->n_conns, 100) < 0 && errno != EINTR)
+      break;
+    for (int i = 0; i < w->n_conns; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      LoadConn *c = &conns[i];
+      ssize_t n = read(c->fd, buf, sizeof(buf));
+      if (n <= 0) {
+        w->failed++;
+        close(c->fd);
+        c->fd = fds[i].fd = -1;
+        continue;
+      }
+      c->got += n;
+      if (c->got < response_len)
+        continue;
+
+      gint64 latency = g_get_monotonic_time() - c->sent_at;
+      g_array_append_val(w->latencies, latency);
+      if (load_send(c) < 0) {
+        w->failed++;
+        close(c->fd);
+        c->fd = fds[i].fd = -1;
+      }
+    }
+  }
+
+  for (int i = 0; i < w->n_conns; i++)
+    if (conns[i].fd >= 0)
+      close(conns[i].fd);
+  free(fds);
+  free(conns);
+  return NULL;
+}
+
+static void *server_thread(void *data) {
+  if (http_server_run(data) < 0)
+    perror("http_server_run");
+  return NULL;
+}
+
+static int compare_gint64(const void *a, const void *b) {
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile_ms(GArray *sorted, double p) {
+  if (sorted->len == 0)
+    return 0;
+  size_t i = (size_t)(p * (sorted->len - 1) + 0.5);
+  return g_array_index(sorted, gint64, i) / 1000.0;
+}
+
+static gint64 thread_cpu_us(pthread_t tid) {
+  clockid_t clock;
+  struct timespec ts;
+  if (pthread_getcpuclockid(tid, &clock) != 0 ||
+      clock_gettime(clock, &ts) != 0)
+    return 0;
+  return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/**
+ * Load a fresh server on `backend` for `seconds`.
+ * @returns the run's results, or NULL if the backend is unavailable
+ */
+static json_t *load_run(HttpBackend backend, int n_conns, int n_threads,
+                        int seconds) {
+  HttpServer *server = http_server_new_with_backend(0, handler, NULL, backend);
+  if (!server)
+    return NULL;
+  pthread_t server_tid;
+  pthread_create(&server_tid, NULL, server_thread, server);
+
+  LoadWorker *workers = calloc(n_threads, sizeof(LoadWorker));
+  pthread_t *tids = calloc(n_threads, sizeof(pthread_t));
+  gint64 start = g_get_monotonic_time();
+  gint64 cpu_start = thread_cpu_us(server_tid);
+  for (int i = 0; i < n_threads; i++) {
+    workers[i].port = http_server_port(server);
+    workers[i].n_conns = n_conns / n_threads + (i < n_conns % n_threads);
+    workers[i].deadline = start + (gint64)seconds * G_USEC_PER_SEC;
+    workers[i].latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+    pthread_create(&tids[i], NULL, load_worker, &workers[i]);
+  }
+
+  GArray *latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+  int failed = 0;
+  for (int i = 0; i < n_threads; i++) {
+    pthread_join(tids[i], NULL);
+    g_array_append_vals(latencies, workers[i].latencies->data,
+                        workers[i].latencies->len);
+    g_array_free(workers[i].latencies, TRUE);
+    failed += workers[i].failed;
+  }
+  double elapsed = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+  gint64 cpu_us = thread_cpu_us(server_tid) - cpu_start;
+  const char *name = http_server_backend_name(server);
+
+  http_server_stop(server);
+  pthread_join(server_tid, NULL);
+
+  g_array_sort(latencies, compare_gint64);
+  json_t *run = json_pack(
+      "{s:s, s:f, s:I, s:i, s:f, s:f, s:f, s:f, s:f}", "backend", name,
+      "seconds", elapsed, "requests", (json_int_t)latencies->len, "failed",
+      failed, "requests_per_sec", latencies->len / elapsed,
+      "cpu_us_per_request",
+      latencies->len ? (double)cpu_us / latencies->len : 0.0, "p50_ms",
+      percentile_ms(latencies, 0.50), "p99_ms",
+      percentile_ms(latencies, 0.99), "max_ms", percentile_ms(latencies, 1.0));
+  http_server_free(server);
+
+  g_array_free(latencies, TRUE);
+  free(tids);
+  free(workers);
+  return run;
+}
+
+static void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -c, --connections N  concurrent keep-alive connections "
+          "(default 256)\n"
+          "  -t, --threads N      client threads (default 4)\n"
+          "  -d, --duration N     seconds to run each backend for "
+          "(default 5)\n"
+          "  -b, --backend NAME   epoll, io_uring or all (default all)\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  int n_conns = 256, n_threads = 4, seconds = 5;
+  const char *backend = "all";
+
+  const struct option long_options[] = {
+      {"connections", required_argument, NULL, 'c'},
+      {"threads", required_argument, NULL, 't'},
+      {"duration", required_argument, NULL, 'd'},
+      {"backend", required_argument, NULL, 'b'},
+      {"help", no_argument, NULL, 'h'},
+      {0, 0, 0, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "c:t:d:b:h", long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+    case 'c':
+      n_conns = atoi(optarg);
+      break;
+    case 't':
+      n_threads = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'b':
+      backend = optarg;
+      break;
+    case 'h':
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  int all = strcmp(backend, "all") == 0;
+  if (n_conns < 1 || n_threads < 1 || seconds < 1 ||
+      (!all && strcmp(backend, "epoll") != 0 &&
+       strcmp(backend, "kqueue") != 0 && strcmp(backend, "io_uring") != 0)) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (n_threads > n_conns)
+    n_threads = n_conns;
+
+  // both ends of every connection live in this process
+  struct rlimit nofile;
+  if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 &&
+      nofile.rlim_cur < (rlim_t)n_conns * 2 + 64) {
+    nofile.rlim_cur = nofile.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &nofile);
+  }
+
+  response_len = snprintf(NULL, 0,
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: keep-alive\r\n"
+                          "\r\n"
+                          "%s",
+                          strlen(body), body);
+
+  json_t *runs = json_array();
+  if (all || strcmp(backend, "io_uring") != 0) {
+    json_t *run = load_run(HTTP_BACKEND_POLL, n_conns, n_threads, seconds);
+    if (!run) {
+      perror("http_server_new");
+      return EXIT_FAILURE;
+    }
+    json_array_append_new(runs, run);
+  }
+  if (all || strcmp(backend, "io_uring") == 0) {
+    json_t *run = load_run(HTTP_BACKEND_IO_URING, n_conns, n_threads, seconds);
+    if (run)
+      json_array_append_new(runs, run);
+    else if (!all || errno != ENOSYS)
+      perror("io_uring");
+    if (!run && !all)
+      return EXIT_FAILURE;
+  }
+
+  json_t *root = json_pack("{s:i, s:i, s:o}", "connections", n_conns,
+                           "threads", n_threads, "runs", runs);
+  json_dumpf(root, stdout, JSON_INDENT(2));
+  fputc('\n', stdout);
+  json_decref(root);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/*
+
+HTTP request parser microbenchmark.
+
+Parses a handful of realistic request heads (a browser, curl, the OAuth
+redirect with its long query, a status bar polling over HTTP/1.0) over and
+over, once with each request arriving whole and once arriving in small
+pieces, the way a slow client or a congested link delivers it. Results go to
+stdout as JSON:
+
+  snp-http-parse [-m min-ms] [-p piece-bytes] > run.json
+
+*/
+
+#include <getopt.h>
+#include <glib.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http-server.h"
+
+typedef struct {
+  const char *name;
+  const char *text;
+  /** Query parameter looked up after each parse, or NULL. */
+  const char *lookup;
+} BenchRequest;
+
+static const BenchRequest requests[] = {
+    {"browser",
+     "GET /events HTTP/1.1\r\n"
+     "Host: localhost:8080\r\n"
+     "Connection: keep-alive\r\n"
+     "Cache-Control: no-cache\r\n"
+     "sec-ch-ua: \"Chromium\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+     "sec-ch-ua-mobile: ?0\r\n"
+     "sec-ch-ua-platform: \"macOS\"\r\n"
+     "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) "
+     "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 "
+     "Safari/537.36\r\n"
+     "Accept: text/event-stream\r\n"
+     "Sec-Fetch-Site: same-origin\r\n"
+     "Sec-Fetch-Mode: cors\r\n"
+     "Sec-Fetch-Dest: empty\r\n"
+     "Referer: http://localhost:8080/\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Accept-Language: en-GB,en;q=0.9\r\n"
+     "\r\n",
+     NULL},
+    {"curl",
+     "GET /events HTTP/1.1\r\n"
+     "Host: localhost:8080\r\n"
+     "User-Agent: curl/8.5.0\r\n"
+     "Accept: */*\r\n"
+     "\r\n",
+     NULL},
+    {"oauth-callback",
+     "GET /?code=AQBxk5Rz3v0c9uQk2fM8c1Jm7pWc1y3n0t5h0u2eK4mZb8rLq9sT6vX1aD3gF"
+     "5hJ7kL9zX2cV4bN6mQ8wE0rT2yU4iO6pA8sD0fG2hJ4kL6zX8cV0bN2mQ4wE6rT8yU0iO2p"
+     "A4sD6fG8hJ0kL2zX4cV6bN8mQ0wE2rT4yU6iO8pA0sD2fG4hJ6kL8zX0cV2bN4mQ6wE8rT"
+     "0yU2iO4pA6sD8fG0hJ2kL4zX6cV8bN0mQ2wE4rT6yU8iO0pA2sD4fG6hJ8kL0zX2cV4b"
+     "&state=x%2By%3Dz HTTP/1.1\r\n"
+     "Host: localhost:25565\r\n"
+     "Connection: keep-alive\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 "
+     "Firefox/125.0\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;"
+     "q=0.8\r\n"
+     "Accept-Language: en-US,en;q=0.5\r\n"
+     "Accept-Encoding: gzip, deflate, br\r\n"
+     "\r\n",
+     "code"},
+    {"status-bar",
+     "GET /events?format=json&fields=track%2Cartists HTTP/1.0\r\n"
+     "Host: 127.0.0.1\r\n"
+     "Connection: keep-alive\r\n"
+     "\r\n",
+     "fields"},
+};
+
+typedef struct {
+  double requests_per_sec;
+  double mb_per_sec;
+  double ns_per_request;
+} BenchResult;
+
+/** Parse `text` until done, `piece` bytes more at a time (0: all at once). */
+static size_t parse_once(const BenchRequest *r, size_t len, size_t piece) {
+  HttpRequest request;
+  http_request_init(&request);
+  HttpParseStatus status;
+  if (piece == 0) {
+    status = http_request_parse(&request, r->text, len);
+  } else {
+    size_t avail = 0;
+    do {
+      avail = avail + piece < len ? avail + piece : len;
+      status = http_request_parse(&request, r->text, avail);
+    } while (status == HTTP_PARSE_INCOMPLETE && avail < len);
+  }
+  if (status != HTTP_PARSE_DONE) {
+    fprintf(stderr, "%s: did not parse (%d)\n", r->name, request.error);
+    exit(EXIT_FAILURE);
+  }
+  if (r->lookup && http_request_query_find(&request, r->lookup) < 0) {
+    fprintf(stderr, "%s: %s not found\n", r->name, r->lookup);
+    exit(EXIT_FAILURE);
+  }
+  return request.head_len;
+}
+
+static BenchResult bench(const BenchRequest *r, size_t piece, int min_ms) {
+  size_t len = strlen(r->text);
+  // keeps the compiler from dropping the parse as unused
+  volatile size_t sink = 0;
+
+  unsigned long n = 0, batch = 1000;
+  gint64 start = g_get_monotonic_time(), elapsed;
+  do {
+    for (unsigned long i = 0; i < batch; i++)
+      sink += parse_once(r, len, piece);
+    n += batch;
+    elapsed = g_get_monotonic_time() - start;
+  } while (elapsed < (gint64)min_ms * 1000);
+  (void)sink;
+
+  double secs = elapsed / (double)G_USEC_PER_SEC;
+  return (BenchResult){
+      .requests_per_sec = n / secs,
+      .mb_per_sec = n * len / secs / 1e6,
+      .ns_per_request = secs * 1e9 / n,
+  };
+}
+
+static void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -m, --min-ms N  time to spend per request and mode (default 500)\n"
+          "  -p, --piece N   bytes per read when arriving in pieces "
+          "(default 64)\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  int min_ms = 500;
+  int piece = 64;
+
+  const struct option long_options[] = {
+      {"min-ms", required_argument, NULL, 'm'},
+      {"piece", required_argument, NULL, 'p'},
+      {"help", no_argument, NULL, 'h'},
+      {0, 0, 0, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "m:p:h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'm':
+      min_ms = atoi(optarg);
+      break;
+    case 'p':
+      piece = atoi(optarg);
+      break;
+    case 'h':
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (piece < 1) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  json_t *results = json_array();
+  for (size_t i = 0; i < G_N_ELEMENTS(requests); i++) {
+    const BenchRequest *r = &requests[i];
+    const int pieces[] = {0, piece};
+    for (size_t j = 0; j < G_N_ELEMENTS(pieces); j++) {
+      BenchResult res = bench(r, pieces[j], min_ms);
+      json_array_append_new(
+          results,
+          json_pack("{s:s, s:i, s:i, s:f, s:f, s:f}", "request", r->name,
+                    "bytes", (int)strlen(r->text), "piece_bytes", pieces[j],
+                    "requests_per_sec", res.requests_per_sec, "mb_per_sec",
+                    res.mb_per_sec, "ns_per_request", res.ns_per_request));
+    }
+  }
+
+  json_t *root = json_pack("{s:o}", "results", results);
+  json_dumpf(root, stdout, JSON_INDENT(2));
+  fputc('\n', stdout);
+  json_decref(root);
+  return EXIT_SUCCESS;
+}
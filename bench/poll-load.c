@@ -0,0 +1,209 @@
+/*
+
+Multi-account polling load test.
+
+Starts the embedded HTTP server on a free port as a stand-in for the
+currently-playing endpoint, answering every poll with the same track, then
+polls it for N accounts at once with the poll engine on this thread.
+Results go to stdout as JSON:
+
+  snp-poll-load [-n sessions] [-i interval_ms] [-m max_in_flight]
+                [-d seconds] > run.json
+
+Lag is how long after it was due each poll started; CPU is the engine
+thread's alone.
+
+*/
+
+#include <getopt.h>
+#include <glib.h>
+#include <jansson.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http-server.h"
+#include "poll-engine.h"
+
+static const char body[] =
+    "{\"timestamp\":1700000000000,\"progress_ms\":61000,\"is_playing\":true,"
+    "\"currently_playing_type\":\"track\",\"item\":{\"id\":"
+    "\"4uLU6hMCjMI75M1A2tKUQC\",\"name\":\"Never Gonna Give You Up\","
+    "\"duration_ms\":213573,\"artists\":[{\"name\":\"Rick Astley\"}],"
+    "\"album\":{\"name\":\"Whenever You Need Somebody\",\"images\":["
+    "{\"url\":\"https://i.scdn.co/image/ab67616d0000b273\",\"width\":640,"
+    "\"height\":640},{\"url\":\"https://i.scdn.co/image/ab67616d00001e02\","
+    "\"width\":300,\"height\":300},{\"url\":"
+    "\"https://i.scdn.co/image/ab67616d00004851\",\"width\":64,"
+    "\"height\":64}]}}}";
+
+static int handler(HttpRequest *req, HttpResponse *res, void *user_data) {
+  (void)req;
+  (void)user_data;
+  res->code = 200;
+  res->content_type = "application/json";
+  http_response_body(res, body, sizeof(body) - 1, NULL, NULL);
+  return 0;
+}
+
+static void *server_thread(void *data) {
+  if (http_server_run(data) < 0)
+    perror("http_server_run");
+  return NULL;
+}
+
+typedef struct {
+  PollEngine *engine;
+  int seconds;
+} Stopper;
+
+static void *stopper_thread(void *data) {
+  Stopper *stopper = data;
+  sleep(stopper->seconds);
+  poll_engine_stop(stopper->engine);
+  return NULL;
+}
+
+static unsigned long tracks;
+
+static void on_result(PollSession *session, SpotifyCurrentlyPlaying *playing,
+                      void *data) {
+  (void)session;
+  (void)data;
+  tracks += playing->track_name != NULL;
+  spotify_currently_playing_free(playing);
+}
+
+static double cpu_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -n, --sessions N       accounts polled (default 2000)\n"
+          "  -i, --interval MS      between polls of an account "
+          "(default 1000)\n"
+          "  -m, --max-in-flight N  polls in flight at once (default %d)\n"
+          "  -d, --duration N       seconds to run for (default 10)\n",
+          argv0, POLL_ENGINE_MAX_IN_FLIGHT);
+}
+
+int main(int argc, char **argv) {
+  int n_sessions = 2000, interval_ms = 1000, seconds = 10;
+  int max_in_flight = POLL_ENGINE_MAX_IN_FLIGHT;
+
+  const struct option long_options[] = {
+      {"sessions", required_argument, NULL, 'n'},
+      {"interval", required_argument, NULL, 'i'},
+      {"max-in-flight", required_argument, NULL, 'm'},
+      {"duration", required_argument, NULL, 'd'},
+      {"help", no_argument, NULL, 'h'},
+      {0, 0, 0, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:i:m:d:h", long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+    case 'n':
+      n_sessions = atoi(optarg);
+      break;
+    case 'i':
+      interval_ms = atoi(optarg);
+      break;
+    case 'm':
+      max_in_flight = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'h':
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (n_sessions < 1 || interval_ms < 1 || max_in_flight < 1 || seconds < 1) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // both ends of every connection live in this process
+  struct rlimit nofile;
+  if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 &&
+      nofile.rlim_cur < (rlim_t)max_in_flight * 2 + 64) {
+    nofile.rlim_cur = nofile.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &nofile);
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  HttpServer *server = http_server_new(0, handler, NULL);
+  if (!server) {
+    perror("http_server_new");
+    return EXIT_FAILURE;
+  }
+  pthread_t server_tid;
+  pthread_create(&server_tid, NULL, server_thread, server);
+
+  char endpoint[64];
+  snprintf(endpoint, sizeof(endpoint),
+           "http://127.0.0.1:%hu/v1/me/player/currently-playing",
+           http_server_port(server));
+  PollEngineOptions options = {.endpoint = endpoint,
+                               .interval_ms = interval_ms,
+                               .max_in_flight = max_in_flight,
+                               .callback = on_result};
+  PollEngine *engine = poll_engine_new(&options);
+  SpotifyAuth *auths = calloc(n_sessions, sizeof(SpotifyAuth));
+  for (int i = 0; i < n_sessions; i++) {
+    snprintf(auths[i].access_token, sizeof(auths[i].access_token),
+             "bench-%d", i);
+    if (!poll_engine_add(engine, &auths[i], NULL)) {
+      fprintf(stderr, "poll_engine_add failed\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  Stopper stopper = {engine, seconds};
+  pthread_t stopper_tid;
+  pthread_create(&stopper_tid, NULL, stopper_thread, &stopper);
+  gint64 start = g_get_monotonic_time();
+  double cpu_start = cpu_seconds();
+  int ret = poll_engine_run(engine);
+  double cpu = cpu_seconds() - cpu_start;
+  double elapsed = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+  pthread_join(stopper_tid, NULL);
+  if (ret < 0)
+    fprintf(stderr, "poll_engine_run failed\n");
+
+  PollEngineStats stats;
+  poll_engine_stats(engine, &stats);
+  json_t *root = json_pack(
+      "{s:i, s:i, s:i, s:f, s:I, s:I, s:I, s:f, s:f, s:f, s:f, s:f, s:f}",
+      "sessions", stats.sessions, "interval_ms", interval_ms, "max_in_flight",
+      max_in_flight, "seconds", elapsed, "polls", (json_int_t)stats.polls,
+      "failures", (json_int_t)stats.failures, "tracks", (json_int_t)tracks,
+      "polls_per_sec", stats.polls / elapsed, "expected_polls_per_sec",
+      n_sessions * 1000.0 / interval_ms, "cpu_us_per_poll",
+      stats.polls ? cpu * 1e6 / stats.polls : 0.0, "lag_p50_ms",
+      stats.lag_p50_ms, "lag_p99_ms", stats.lag_p99_ms, "lag_max_ms",
+      stats.lag_max_ms);
+  json_dumpf(root, stdout, JSON_INDENT(2));
+  fputc('\n', stdout);
+  json_decref(root);
+
+  poll_engine_free(engine);
+  free(auths);
+  http_server_stop(server);
+  pthread_join(server_tid, NULL);
+  http_server_free(server);
+  return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,255 @@
+/*
+
+Headless render benchmark.
+
+Builds a ChafaTermInfo for a set of terminal profiles and renders covers in
+every mode each profile supports, at several geometries, entirely in memory.
+Results go to stdout as JSON, for comparing builds:
+
+  snp-render-bench [-p profile]... [-g WxH]... [cover.jpg]... > run.json
+
+Without covers, a synthetic 640x640 one is used. Build with
+-Dalloc_stats=true to get allocations per frame.
+
+*/
+
+#include <getopt.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc-stats.h"
+#include "render-bench.h"
+#include "spotify.h"
+
+#define MAX_SELECTED 16
+
+typedef struct {
+  const char *name;
+  /** Environment the profile is detected from, NULL-terminated pairs. */
+  const char *env[4][2];
+} BenchProfile;
+
+static const BenchProfile profiles[] = {
+    {"xterm-truecolor",
+     {{"TERM", "xterm-256color"}, {"COLORTERM", "truecolor"}}},
+    {"xterm-256color", {{"TERM", "xterm-256color"}}},
+    {"linux", {{"TERM", "linux"}}},
+    {"vt100", {{"TERM", "vt100"}}},
+    {"mlterm", {{"TERM", "mlterm"}}},
+    {"kitty", {{"TERM", "xterm-kitty"}}},
+    {"iterm2", {{"TERM", "xterm-256color"}, {"TERM_PROGRAM", "iTerm.app"}}},
+    {NULL, {{NULL, NULL}}},
+};
+
+static const int default_geometries[][2] = {{14, 7}, {40, 20}, {80, 40}};
+
+static ChafaTermInfo *profile_term_info(const BenchProfile *profile) {
+  // start from an empty environment so the host terminal does not leak in
+  gchar **envp = NULL;
+  for (int i = 0; i < 4 && profile->env[i][0]; i++)
+    envp = g_environ_setenv(envp, profile->env[i][0], profile->env[i][1], TRUE);
+
+  ChafaTermInfo *term_info =
+      chafa_term_db_detect(chafa_term_db_get_default(), envp);
+  g_strfreev(envp);
+  return term_info;
+}
+
+static gboolean mode_supported(ChafaTermInfo *ti, const RenderBenchMode *m) {
+  switch (m->pixel_mode) {
+  case CHAFA_PIXEL_MODE_SIXELS:
+    return chafa_term_info_have_seq(ti, CHAFA_TERM_SEQ_BEGIN_SIXELS);
+  case CHAFA_PIXEL_MODE_KITTY:
+    return chafa_term_info_have_seq(
+        ti, CHAFA_TERM_SEQ_BEGIN_KITTY_IMMEDIATE_IMAGE_V1);
+  case CHAFA_PIXEL_MODE_ITERM2:
+    return chafa_term_info_have_seq(ti, CHAFA_TERM_SEQ_BEGIN_ITERM2_IMAGE);
+  default:
+    break;
+  }
+
+  switch (m->canvas_mode) {
+  case CHAFA_CANVAS_MODE_TRUECOLOR:
+    return chafa_term_info_have_seq(ti, CHAFA_TERM_SEQ_SET_COLOR_FGBG_DIRECT);
+  case CHAFA_CANVAS_MODE_INDEXED_240:
+    return chafa_term_info_have_seq(ti, CHAFA_TERM_SEQ_SET_COLOR_FGBG_256);
+  case CHAFA_CANVAS_MODE_INDEXED_16:
+    return chafa_term_info_have_seq(ti, CHAFA_TERM_SEQ_SET_COLOR_FGBG_16);
+  default:
+    return TRUE;
+  }
+}
+
+static SpotifyAlbumCover *cover_from_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+
+  ResponseBuffer *buf = response_buffer_new();
+  char chunk[BUFSIZ];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    response_buffer_write_bytes(buf, chunk, n);
+  fclose(f);
+
+  // the buffer is the cover's, or freed if it does not decode
+  return spotify_album_cover_from_jpeg(buf);
+}
+
+static int parse_size(const char *s, int *w, int *h) {
+  return sscanf(s, "%dx%d", w, h) == 2 && *w > 0 && *h > 0 ? 0 : -1;
+}
+
+static void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options] [cover.jpg...]\n"
+          "  -p, --profile NAME  terminal profile to render for (repeatable)\n"
+          "  -g, --geometry WxH  canvas size in cells (repeatable)\n"
+          "  -c, --cell WxH      cell size in pixels (default 10x20)\n"
+          "  -m, --min-ms N      time to spend per combination (default 500)\n"
+          "  -t, --threads N     chafa render threads (default: all cores)\n"
+          "profiles:",
+          argv0);
+  for (const BenchProfile *p = profiles; p->name; p++)
+    fprintf(stderr, " %s", p->name);
+  fputc('\n', stderr);
+}
+
+int main(int argc, char **argv) {
+  const BenchProfile *selected[MAX_SELECTED];
+  int n_selected = 0;
+  int geometries[MAX_SELECTED][2];
+  int n_geometries = 0;
+  int cell_width = 10, cell_height = 20;
+  int min_ms = 500;
+  int threads = 0;
+
+  const struct option long_options[] = {
+      {"profile", required_argument, NULL, 'p'},
+      {"geometry", required_argument, NULL, 'g'},
+      {"cell", required_argument, NULL, 'c'},
+      {"min-ms", required_argument, NULL, 'm'},
+      {"threads", required_argument, NULL, 't'},
+      {"help", no_argument, NULL, 'h'},
+      {0, 0, 0, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "p:g:c:m:t:h", long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+    case 'p': {
+      const BenchProfile *p = profiles;
+      while (p->name && strcmp(p->name, optarg) != 0)
+        p++;
+      if (!p->name || n_selected == MAX_SELECTED) {
+        fprintf(stderr, "unknown profile: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      selected[n_selected++] = p;
+      break;
+    }
+    case 'g':
+      if (n_geometries == MAX_SELECTED ||
+          parse_size(optarg, &geometries[n_geometries][0],
+                     &geometries[n_geometries][1]) != 0) {
+        fprintf(stderr, "bad geometry: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      n_geometries++;
+      break;
+    case 'c':
+      if (parse_size(optarg, &cell_width, &cell_height) != 0) {
+        fprintf(stderr, "bad cell size: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'm':
+      min_ms = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'h':
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (n_selected == 0)
+    for (const BenchProfile *p = profiles; p->name; p++)
+      selected[n_selected++] = p;
+  if (n_geometries == 0) {
+    n_geometries = G_N_ELEMENTS(default_geometries);
+    memcpy(geometries, default_geometries, sizeof(default_geometries));
+  }
+  chafa_set_n_threads(threads > 0 ? threads : -1);
+
+  int n_covers = argc - optind;
+  const char *synthetic = "synthetic-640";
+  if (n_covers == 0)
+    n_covers = 1;
+
+  json_t *results = json_array();
+  for (int c = 0; c < n_covers; c++) {
+    const char *cover_name = optind < argc ? argv[optind + c] : synthetic;
+    SpotifyAlbumCover *cover = optind < argc
+                                   ? cover_from_file(cover_name)
+                                   : render_bench_cover_new(640, 640);
+    if (!cover)
+      return EXIT_FAILURE;
+
+    for (int p = 0; p < n_selected; p++) {
+      ChafaTermInfo *term_info = profile_term_info(selected[p]);
+
+      for (const RenderBenchMode *mode = render_bench_modes; mode->name;
+           mode++) {
+        if (!mode_supported(term_info, mode))
+          continue;
+
+        for (int g = 0; g < n_geometries; g++) {
+          RenderBenchResult r;
+          render_bench_run(term_info, mode, cover, geometries[g][0],
+                           geometries[g][1], cell_width, cell_height, min_ms,
+                           &r);
+          fprintf(stderr, "%s %s %s %dx%d: %.2f ms\n", cover_name,
+                  selected[p]->name, mode->name, geometries[g][0],
+                  geometries[g][1], r.ms_per_frame);
+
+          json_array_append_new(
+              results,
+              json_pack("{s:s, s:s, s:s, s:i, s:i, s:i, s:i, s:i, s:f, s:f, "
+                        "s:I, s:o}",
+                        "cover", cover_name, "profile", selected[p]->name,
+                        "mode", mode->name, "width_cells", geometries[g][0],
+                        "height_cells", geometries[g][1], "cell_width",
+                        cell_width, "cell_height", cell_height, "frames",
+                        r.frames, "fps", 1000.0 / r.ms_per_frame,
+                        "ms_per_frame", r.ms_per_frame, "bytes_per_frame",
+                        (json_int_t)r.bytes_per_frame, "allocs_per_frame",
+                        alloc_stats_enabled() ? json_real(r.allocs_per_frame)
+                                              : json_null()));
+        }
+      }
+      chafa_term_info_unref(term_info);
+    }
+    if (optind < argc)
+      spotify_album_cover_free(cover);
+    else
+      render_bench_cover_free(cover);
+  }
+
+  json_t *root = json_pack("{s:i, s:b, s:o}", "chafa_threads",
+                           chafa_get_n_threads(), "alloc_stats",
+                           alloc_stats_enabled(), "results", results);
+  json_dumpf(root, stdout, JSON_INDENT(2));
+  fputc('\n', stdout);
+  json_decref(root);
+  return EXIT_SUCCESS;
+}
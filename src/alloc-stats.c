@@ -0,0 +1,42 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "alloc-stats.h"
+
+#ifdef SNP_ALLOC_STATS
+
+#ifndef __GLIBC__
+#error "alloc_stats needs glibc's __libc_* allocator entry points"
+#endif
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+// thread-local, so a poller thread does not show up in the renderer's count
+static __thread unsigned long alloc_count;
+
+void *malloc(size_t size) {
+  alloc_count++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  alloc_count++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  alloc_count++;
+  return __libc_realloc(ptr, size);
+}
+
+unsigned long alloc_stats_count(void) { return alloc_count; }
+int alloc_stats_enabled(void) { return 1; }
+
+#else
+
+unsigned long alloc_stats_count(void) { return 0; }
+int alloc_stats_enabled(void) { return 0; }
+
+#endif
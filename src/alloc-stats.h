@@ -0,0 +1,20 @@
+/*
+
+Heap allocation counter, for checking that the render path does not allocate.
+
+Only available when built with `-Dalloc_stats=true` on glibc, where malloc,
+calloc and realloc are interposed to count calls made by the current thread
+(chafa and glib included). Otherwise the count is always 0.
+
+*/
+
+#ifndef __SNP_ALLOC_STATS_H__
+#define __SNP_ALLOC_STATS_H__
+
+/** Allocations made so far by the calling thread. */
+unsigned long alloc_stats_count(void);
+
+/** Whether alloc_stats_count actually counts anything in this build. */
+int alloc_stats_enabled(void);
+
+#endif /* __SNP_ALLOC_STATS_H__ */
@@ -14,5 +14,15 @@
 #define SNP_SPOTIFY_API_HOST "https://api.spotify.com/v1"
 #define SNP_SPOTIFY_API_CURRENTLY_PLAYING                                      \
   SNP_SPOTIFY_API_HOST "/me/player/currently-playing"
+#define SNP_SPOTIFY_API_QUEUE SNP_SPOTIFY_API_HOST "/me/player/queue"
+
+#define SNP_POLL_INTERVAL_MS 4000
+/** The queue is read this often, and whenever the track changes. */
+#define SNP_QUEUE_INTERVAL_MS 30000
+/** Covers of this many upcoming tracks are downloaded ahead of time. */
+#define SNP_PREFETCH_COVERS 3
+#define SNP_UI_DEFAULT_FPS 30
+#define SNP_UI_MIN_FPS 10
+#define SNP_UI_MAX_FPS 60
 
 #endif /* __SNP_CONSTANTS_H__ */
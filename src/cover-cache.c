@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "cover-cache.h"
+
+typedef struct {
+  char hash[COVER_HASH_LENGTH + 1];
+  /** The bytes, if they are not on disk. */
+  CoverBytes *bytes;
+} CoverCacheEntry;
+
+struct CoverCache {
+  /** NULL when there is no usable directory. */
+  char *dir;
+
+  /** Guards `recent`, which the poller adds to and the server reads. */
+  pthread_mutex_t lock;
+  /** Most recently added first. */
+  CoverCacheEntry recent[COVER_CACHE_RECENT];
+  unsigned int n_recent;
+  /** Covers written; the directory is pruned every so many. */
+  atomic_uint written;
+};
+
+void cover_bytes_unref(void *bytes) {
+  CoverBytes *b = bytes;
+  if (b && atomic_fetch_sub(&b->refs, 1) == 1)
+    free(b);
+}
+
+char *cover_cache_dir_default(void) {
+  return g_build_filename(g_get_user_cache_dir(), "spotify-now-playing",
+                          "covers", NULL);
+}
+
+typedef struct {
+  char *path;
+  time_t mtime;
+} CoverCacheFile;
+
+static int cover_cache_file_newer(const void *a, const void *b) {
+  time_t x = ((const CoverCacheFile *)a)->mtime;
+  time_t y = ((const CoverCacheFile *)b)->mtime;
+  return (x < y) - (x > y);
+}
+
+/** Delete all but the COVER_CACHE_MAX_FILES most recently used covers. */
+static void cover_cache_prune(const char *dir) {
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if (!d)
+    return;
+  GArray *files = g_array_new(FALSE, FALSE, sizeof(CoverCacheFile));
+  const char *name;
+  while ((name = g_dir_read_name(d))) {
+    if (!g_str_has_suffix(name, ".jpg"))
+      continue;
+    CoverCacheFile file = {g_build_filename(dir, name, NULL), 0};
+    struct stat st;
+    if (stat(file.path, &st) == 0)
+      file.mtime = st.st_mtime;
+    g_array_append_val(files, file);
+  }
+  g_dir_close(d);
+
+  g_array_sort(files, cover_cache_file_newer);
+  for (guint i = 0; i < files->len; i++) {
+    CoverCacheFile *file = &g_array_index(files, CoverCacheFile, i);
+    if (i >= COVER_CACHE_MAX_FILES)
+      g_unlink(file->path);
+    g_free(file->path);
+  }
+  g_array_free(files, TRUE);
+}
+
+CoverCache *cover_cache_new(const char *dir) {
+  CoverCache *cache = calloc(1, sizeof(CoverCache));
+  if (!cache)
+    return NULL;
+  pthread_mutex_init(&cache->lock, NULL);
+  atomic_init(&cache->written, 0);
+  if (dir && g_mkdir_with_parents(dir, 0700) == 0) {
+    cache->dir = g_strdup(dir);
+    cover_cache_prune(dir);
+  } else if (dir) {
+    fprintf(stderr, "cover cache %s: %s; keeping covers in memory\n", dir,
+            strerror(errno));
+  }
+  return cache;
+}
+
+void cover_cache_free(CoverCache *cache) {
+  if (!cache)
+    return;
+  for (unsigned int i = 0; i < cache->n_recent; i++)
+    cover_bytes_unref(cache->recent[i].bytes);
+  pthread_mutex_destroy(&cache->lock);
+  g_free(cache->dir);
+  free(cache);
+}
+
+static char *cover_cache_path(const CoverCache *cache, const char *hash) {
+  char name[COVER_HASH_LENGTH + sizeof(".jpg")];
+  snprintf(name, sizeof(name), "%s.jpg", hash);
+  return g_build_filename(cache->dir, name, NULL);
+}
+
+/**
+ * Make sure the cover is on disk: written to a temporary file and renamed
+ * into place, so a reader never sees half of one.
+ * @returns 0 if it is
+ */
+static int cover_cache_write(const CoverCache *cache, const char *hash,
+                             const void *jpeg, size_t len) {
+  if (!cache->dir)
+    return -1;
+  char *path = cover_cache_path(cache, hash);
+  // already there, maybe from an earlier run: only mark it used
+  if (utime(path, NULL) == 0) {
+    g_free(path);
+    return 0;
+  }
+
+  char *tmp = g_strdup_printf("%s.XXXXXX", path);
+  int fd = g_mkstemp(tmp);
+  int ret = -1;
+  if (fd >= 0) {
+    const char *p = jpeg;
+    size_t left = len;
+    while (left > 0) {
+      ssize_t n = write(fd, p, left);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      p += n;
+      left -= n;
+    }
+    if (close(fd) == 0 && left == 0 && g_rename(tmp, path) == 0)
+      ret = 0;
+    else
+      g_unlink(tmp);
+  }
+  if (ret < 0)
+    fprintf(stderr, "cover cache %s: %s\n", path, strerror(errno));
+  g_free(tmp);
+  g_free(path);
+  return ret;
+}
+
+/** @returns the index of `hash` in `recent`, or -1. Call with the lock held. */
+static int cover_cache_find(const CoverCache *cache, const char *hash) {
+  for (unsigned int i = 0; i < cache->n_recent; i++)
+    if (strcmp(cache->recent[i].hash, hash) == 0)
+      return i;
+  return -1;
+}
+
+/** Move `recent[i]` to the front. Call with the lock held. */
+static void cover_cache_move_front(CoverCache *cache, int i) {
+  CoverCacheEntry entry = cache->recent[i];
+  memmove(&cache->recent[1], &cache->recent[0], i * sizeof(CoverCacheEntry));
+  cache->recent[0] = entry;
+}
+
+int cover_cache_put(CoverCache *cache, const void *jpeg, size_t len,
+                    char hash[COVER_HASH_LENGTH + 1]) {
+  char *hex = g_compute_checksum_for_data(G_CHECKSUM_SHA256, jpeg, len);
+  snprintf(hash, COVER_HASH_LENGTH + 1, "%s", hex);
+  g_free(hex);
+
+  pthread_mutex_lock(&cache->lock);
+  int i = cover_cache_find(cache, hash);
+  int on_disk = i >= 0 && !cache->recent[i].bytes;
+  if (i >= 0)
+    cover_cache_move_front(cache, i);
+  pthread_mutex_unlock(&cache->lock);
+  if (i >= 0) {
+    // pruning goes by mtime: a cover still handed out must look recent
+    if (on_disk) {
+      char *path = cover_cache_path(cache, hash);
+      utime(path, NULL);
+      g_free(path);
+    }
+    return 0;
+  }
+
+  // off the lock: lookups of other covers need not wait on the disk
+  CoverCacheEntry entry = {.bytes = NULL};
+  memcpy(entry.hash, hash, COVER_HASH_LENGTH + 1);
+  if (cover_cache_write(cache, hash, jpeg, len) == 0) {
+    // a long-running process would otherwise only ever add to the directory
+    unsigned int written = atomic_fetch_add(&cache->written, 1) + 1;
+    if (written % COVER_CACHE_MAX_FILES == 0)
+      cover_cache_prune(cache->dir);
+  } else {
+    entry.bytes = malloc(sizeof(CoverBytes) + len);
+    if (!entry.bytes)
+      return -1;
+    atomic_init(&entry.bytes->refs, 1);
+    entry.bytes->len = len;
+    memcpy(entry.bytes->data, jpeg, len);
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  if ((i = cover_cache_find(cache, hash)) >= 0) {
+    // added by another thread meanwhile
+    cover_cache_move_front(cache, i);
+    cover_bytes_unref(entry.bytes);
+  } else {
+    if (cache->n_recent == COVER_CACHE_RECENT)
+      cover_bytes_unref(cache->recent[--cache->n_recent].bytes);
+    cache->recent[cache->n_recent] = entry;
+    cover_cache_move_front(cache, cache->n_recent++);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return 0;
+}
+
+static int cover_cache_valid_hash(const char *hash) {
+  size_t n = 0;
+  for (; hash[n]; n++)
+    if (!g_ascii_isdigit(hash[n]) && !(hash[n] >= 'a' && hash[n] <= 'f'))
+      return 0;
+  return n == COVER_HASH_LENGTH;
+}
+
+int cover_cache_open(CoverCache *cache, const char *hash, CoverCacheHit *hit) {
+  if (!cover_cache_valid_hash(hash))
+    return -1;
+
+  pthread_mutex_lock(&cache->lock);
+  int i = cover_cache_find(cache, hash);
+  CoverBytes *bytes = i >= 0 ? cache->recent[i].bytes : NULL;
+  if (bytes)
+    atomic_fetch_add(&bytes->refs, 1);
+  pthread_mutex_unlock(&cache->lock);
+  if (i < 0)
+    return -1;
+  if (bytes) {
+    *hit = (CoverCacheHit){.fd = -1, .len = bytes->len, .bytes = bytes};
+    return 0;
+  }
+
+  // another process sharing the directory may have pruned it since
+  char *path = cover_cache_path(cache, hash);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  g_free(path);
+  struct stat st;
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  *hit = (CoverCacheHit){.fd = fd, .len = st.st_size, .bytes = NULL};
+  return 0;
+}
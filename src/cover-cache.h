@@ -0,0 +1,78 @@
+/*
+
+Content-addressed store of the album cover JPEGs the poller downloaded, so
+the status server can hand out the very same bytes instead of sending
+clients to Spotify's CDN.
+
+Covers are named by the SHA-256 of their bytes and written once to
+$XDG_CACHE_HOME/spotify-now-playing/covers/<hash>.jpg, which never changes
+for a given name; the server sends them from there with sendfile(). Only
+the most recently added covers can be looked up. If the disk cache cannot
+be written, those are kept in memory instead.
+
+*/
+
+#ifndef __SNP_COVER_CACHE_H__
+#define __SNP_COVER_CACHE_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/** Length of a cover's name: SHA-256 in lowercase hex. */
+#define COVER_HASH_LENGTH 64
+/** Covers that can be looked up: the current track's and recent ones. */
+#define COVER_CACHE_RECENT 16
+/**
+ * Files left on disk when the cache is opened, and again after every so
+ * many covers written; the oldest go first.
+ */
+#define COVER_CACHE_MAX_FILES 256
+
+typedef struct CoverCache CoverCache;
+
+/** Cover bytes held in memory, shared with responses still being sent. */
+typedef struct {
+  atomic_uint refs;
+  size_t len;
+  unsigned char data[];
+} CoverBytes;
+
+void cover_bytes_unref(void *bytes);
+
+/** A cover found by cover_cache_open; exactly one of `fd` and `bytes` is set. */
+typedef struct {
+  /** Open file for the caller to close, or -1. */
+  int fd;
+  size_t len;
+  /** Reference for the caller to drop, or NULL. */
+  CoverBytes *bytes;
+} CoverCacheHit;
+
+/** Default directory, under $XDG_CACHE_HOME. Free with g_free. */
+char *cover_cache_dir_default(void);
+
+/**
+ * Open the cache in `dir`, creating it if needed and pruning it to
+ * COVER_CACHE_MAX_FILES, as it is again once that many more covers were
+ * written. A cache that cannot use `dir` still works, from
+ * memory.
+ */
+CoverCache *cover_cache_new(const char *dir);
+
+void cover_cache_free(CoverCache *cache);
+
+/**
+ * Add the cover `jpeg` and write its name to `hash`. Safe to call from any
+ * thread.
+ * @returns 0 on success, -1 if out of memory
+ */
+int cover_cache_put(CoverCache *cache, const void *jpeg, size_t len,
+                    char hash[COVER_HASH_LENGTH + 1]);
+
+/**
+ * Look up a recent cover by name. Safe to call from any thread.
+ * @returns 0 and fills `hit`, or -1 if it is unknown or no longer readable
+ */
+int cover_cache_open(CoverCache *cache, const char *hash, CoverCacheHit *hit);
+
+#endif /* __SNP_COVER_CACHE_H__ */
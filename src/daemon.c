@@ -0,0 +1,477 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "term-util.h"
+
+/** Environment variables chafa's terminal detection looks at. */
+static const char *daemon_env_names[] = {
+    "TERM",        "COLORTERM",       "TERM_PROGRAM", "TERM_PROGRAM_VERSION",
+    "VTE_VERSION", "KITTY_WINDOW_ID", "MLTERM",       "KONSOLE_VERSION",
+    "LC_TERMINAL", "WT_SESSION",      "TMUX",         NULL,
+};
+
+/** What makes two clients' output byte-identical. Compared with memcmp. */
+typedef struct {
+  char term_name[64];
+  ChafaCanvasMode canvas_mode;
+  ChafaPixelMode pixel_mode;
+  gboolean sync_output;
+  int w_cell, h_cell;
+  int cw_px, ch_px;
+} DaemonViewKey;
+
+/** One rendering, shared by every client whose terminal has the same key. */
+typedef struct DaemonView {
+  DaemonViewKey key;
+  struct ui_ctx ui;
+  int n_clients;
+  struct DaemonView *next;
+} DaemonView;
+
+typedef struct {
+  /** -1 for a free slot. */
+  int fd;
+  /** Partial command line received so far. */
+  char line[512];
+  size_t line_len;
+  gchar **envp;
+  int n_env;
+  /** NULL until the first size command. */
+  DaemonView *view;
+
+  /** Output the socket would not take yet; sent from backlog_sent on. */
+  FrameBuffer backlog;
+  size_t backlog_sent;
+  /** Skipping frames until the backlog drains. */
+  gboolean behind;
+} DaemonClient;
+
+typedef struct {
+  const DaemonOptions *options;
+  int listen_fd;
+  DaemonClient clients[DAEMON_MAX_CLIENTS];
+  DaemonView *views;
+
+  /** Per tick, for --stats. */
+  int views_composed;
+  int frames_sent;
+  size_t bytes_composed;
+} Daemon;
+
+void daemon_socket_path_default(char *dest, size_t n) {
+  const char *runtime = g_getenv("XDG_RUNTIME_DIR");
+  if (runtime && *runtime)
+    snprintf(dest, n, "%s/spotify-now-playing.sock", runtime);
+  else
+    snprintf(dest, n, "/tmp/spotify-now-playing-%d.sock", (int)getuid());
+}
+
+static int daemon_sockaddr(struct sockaddr_un *addr, const char *path) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+static void daemon_set_nonblock(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static int daemon_listen(const char *path) {
+  struct sockaddr_un addr;
+  if (daemon_sockaddr(&addr, path) != 0)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  // a socket file nobody answers on is left over from a daemon that died;
+  // anything else at `path` is left alone, and bind reports it
+  struct stat st;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    close(fd);
+    errno = EADDRINUSE;
+    return -1;
+  }
+  if (errno == ECONNREFUSED && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  // anyone may attach: who can reach the socket is up to its directory
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      chmod(path, 0666) != 0 || listen(fd, 16) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  daemon_set_nonblock(fd);
+  return fd;
+}
+
+/** The view for `term`, created if needed. Takes over term->term_info. */
+static DaemonView *daemon_view_get(Daemon *d, UiTerminal *term) {
+  DaemonViewKey key;
+  memset(&key, 0, sizeof(key)); // padding takes part in memcmp
+  const char *name = chafa_term_info_get_name(term->term_info);
+  snprintf(key.term_name, sizeof(key.term_name), "%s", name ? name : "");
+  key.canvas_mode = term->canvas_mode;
+  key.pixel_mode = term->pixel_mode;
+  key.sync_output = term->sync_output;
+  key.w_cell = term->dim.w_cell;
+  key.h_cell = term->dim.h_cell;
+  key.cw_px = term->dim.cw_px;
+  key.ch_px = term->dim.ch_px;
+
+  for (DaemonView *v = d->views; v; v = v->next) {
+    if (memcmp(&v->key, &key, sizeof(key)) == 0) {
+      chafa_term_info_unref(term->term_info);
+      // the newcomer has seen none of the frames so far
+      ui_invalidate(&v->ui);
+      return v;
+    }
+  }
+
+  DaemonView *v = calloc(1, sizeof(*v));
+  if (!v) {
+    chafa_term_info_unref(term->term_info);
+    return NULL;
+  }
+  v->key = key;
+  ui_init(&v->ui, term);
+  v->ui.renderer = d->options->renderer;
+  v->next = d->views;
+  d->views = v;
+  return v;
+}
+
+static void daemon_view_put(Daemon *d, DaemonView *view) {
+  if (--view->n_clients > 0)
+    return;
+
+  for (DaemonView **v = &d->views; *v; v = &(*v)->next) {
+    if (*v == view) {
+      *v = view->next;
+      break;
+    }
+  }
+  ui_teardown(&view->ui);
+  free(view);
+}
+
+static void daemon_client_close(Daemon *d, DaemonClient *c) {
+  close(c->fd);
+  c->fd = -1;
+  if (c->view)
+    daemon_view_put(d, c->view);
+  c->view = NULL;
+  g_strfreev(c->envp);
+  c->envp = NULL;
+  frame_free(&c->backlog);
+}
+
+/** Put `c` in the view matching its environment and `size`. */
+static int daemon_client_attach(Daemon *d, DaemonClient *c, TermSize size) {
+  UiTerminal term;
+  ui_terminal_detect(&term, c->envp, size);
+  DaemonView *view = daemon_view_get(d, &term);
+  if (!view)
+    return -1;
+
+  // join the new view before leaving the old, which may be the same one
+  view->n_clients++;
+  if (c->view)
+    daemon_view_put(d, c->view);
+  c->view = view;
+  return 0;
+}
+
+static int daemon_client_command(Daemon *d, DaemonClient *c, char *line) {
+  if (strncmp(line, "env ", 4) == 0) {
+    char *value = strchr(line + 4, '=');
+    if (!value || c->n_env >= DAEMON_MAX_ENV)
+      return 0;
+    *value++ = 0;
+    c->envp = g_environ_setenv(c->envp, line + 4, value, TRUE);
+    c->n_env++;
+    return 0;
+  }
+
+  TermSize size;
+  if (sscanf(line, "size %d %d %d %d", &size.width_cells, &size.height_cells,
+             &size.width_pixels, &size.height_pixels) == 4)
+    return daemon_client_attach(d, c, size);
+  return 0; // unknown commands are for newer daemons
+}
+
+/** Read and act on whatever the client sent. @returns -1 to drop it */
+static int daemon_client_read(Daemon *d, DaemonClient *c) {
+  ssize_t n = read(c->fd, c->line + c->line_len,
+                   sizeof(c->line) - c->line_len - 1);
+  if (n < 0)
+    return errno == EAGAIN || errno == EINTR ? 0 : -1;
+  if (n == 0)
+    return -1;
+
+  c->line_len += n;
+  c->line[c->line_len] = 0;
+  char *start = c->line, *nl;
+  while ((nl = strchr(start, '\n'))) {
+    *nl = 0;
+    if (daemon_client_command(d, c, start) != 0)
+      return -1;
+    start = nl + 1;
+  }
+
+  c->line_len -= start - c->line;
+  memmove(c->line, start, c->line_len);
+  // a line that can never end
+  return c->line_len < sizeof(c->line) - 1 ? 0 : -1;
+}
+
+/** Send as much of the backlog as the socket takes. @returns -1 on error */
+static int daemon_client_drain(Daemon *d, DaemonClient *c) {
+  while (c->backlog_sent < c->backlog.len) {
+    ssize_t n = write(c->fd, c->backlog.data + c->backlog_sent,
+                      c->backlog.len - c->backlog_sent);
+    if (n < 0)
+      return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    c->backlog_sent += n;
+  }
+
+  frame_reset(&c->backlog);
+  c->backlog_sent = 0;
+  if (c->behind) {
+    // it missed frames, so everyone in its view gets a full one
+    c->behind = FALSE;
+    ui_invalidate(&c->view->ui);
+  }
+  return 0;
+}
+
+/**
+ * Send a composed frame: straight from the view's buffer if nothing is
+ * queued, otherwise behind what is. @returns -1 on error
+ */
+static int daemon_client_send(DaemonClient *c, const char *data, size_t len) {
+  if (c->behind)
+    return 0;
+
+  if (c->backlog.len == 0) {
+    ssize_t n = write(c->fd, data, len);
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+      return -1;
+    if (n > 0) {
+      data += n;
+      len -= n;
+    }
+    if (len == 0)
+      return 0;
+  }
+
+  // one frame is always queued, however large, so there is something to
+  // drain before catching up
+  if (c->backlog.len > 0 &&
+      c->backlog.len - c->backlog_sent + len > DAEMON_BACKLOG_MAX) {
+    c->behind = TRUE; // frames are deltas: skip whole ones only
+    return 0;
+  }
+  frame_append(&c->backlog, data, len);
+  return 0;
+}
+
+static void daemon_accept(Daemon *d) {
+  int fd;
+  while ((fd = accept(d->listen_fd, NULL, NULL)) >= 0) {
+    DaemonClient *c = NULL;
+    for (int i = 0; i < DAEMON_MAX_CLIENTS && !c; i++)
+      if (d->clients[i].fd < 0)
+        c = &d->clients[i];
+    if (!c) {
+      close(fd);
+      continue;
+    }
+
+    daemon_set_nonblock(fd);
+    c->fd = fd;
+    c->line_len = 0;
+    c->envp = NULL;
+    c->n_env = 0;
+    c->view = NULL;
+    frame_init(&c->backlog);
+    c->backlog_sent = 0;
+    c->behind = FALSE;
+  }
+}
+
+/** Compose every view once and hand the bytes to all of its clients. */
+static void daemon_tick(Daemon *d, SnapshotSlot *slot) {
+  d->views_composed = d->frames_sent = 0;
+  d->bytes_composed = 0;
+
+  SpotifyCurrentlyPlaying *playing = snapshot_acquire(slot);
+  for (DaemonView *v = d->views; v; v = v->next) {
+    ui_compose(&v->ui, playing);
+    FrameBuffer *frame = &v->ui.frame;
+    d->views_composed++;
+    d->bytes_composed += frame->len;
+    if (frame->len == 0)
+      continue;
+
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+      DaemonClient *c = &d->clients[i];
+      if (c->fd < 0 || c->view != v)
+        continue;
+      if (daemon_client_send(c, frame->data, frame->len) != 0) {
+        // closed by the next poll; closing here could free v under us
+        c->behind = TRUE;
+        shutdown(c->fd, SHUT_RDWR);
+      } else {
+        d->frames_sent++;
+      }
+    }
+  }
+  snapshot_release(slot);
+}
+
+int daemon_run(const char *path, SnapshotSlot *slot,
+               const DaemonOptions *options) {
+  Daemon d = {.options = options, .views = NULL};
+  d.listen_fd = daemon_listen(path);
+  if (d.listen_fd < 0)
+    return -1;
+  for (int i = 0; i < DAEMON_MAX_CLIENTS; i++)
+    d.clients[i].fd = -1;
+
+  // a client going away mid-write is an EPIPE, not a reason to exit
+  signal(SIGPIPE, SIG_IGN);
+
+  struct pollfd fds[1 + DAEMON_MAX_CLIENTS];
+  DaemonClient *polled[1 + DAEMON_MAX_CLIENTS];
+  gint64 next_frame = g_get_monotonic_time();
+  while (1) {
+    int n_fds = 0;
+    fds[n_fds].fd = d.listen_fd;
+    fds[n_fds].events = POLLIN;
+    polled[n_fds++] = NULL;
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+      DaemonClient *c = &d.clients[i];
+      if (c->fd < 0)
+        continue;
+      fds[n_fds].fd = c->fd;
+      fds[n_fds].events = POLLIN | (c->backlog.len ? POLLOUT : 0);
+      polled[n_fds++] = c;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    int timeout_ms = next_frame > now ? (next_frame - now) / 1000 : 0;
+    if (poll(fds, n_fds, timeout_ms) < 0 && errno != EINTR)
+      return -1;
+
+    for (int i = 0; i < n_fds; i++) {
+      DaemonClient *c = polled[i];
+      if (!fds[i].revents)
+        continue;
+      if (!c) {
+        daemon_accept(&d);
+        continue;
+      }
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR) &&
+           daemon_client_read(&d, c) != 0) ||
+          (fds[i].revents & POLLOUT && daemon_client_drain(&d, c) != 0))
+        daemon_client_close(&d, c);
+    }
+
+    now = g_get_monotonic_time();
+    if (now < next_frame)
+      continue;
+    daemon_tick(&d, slot);
+    if (options->show_stats && d.views_composed)
+      fprintf(stderr, "tick: %d views composed (%zu bytes), sent to %d\n",
+              d.views_composed, d.bytes_composed, d.frames_sent);
+
+    next_frame += G_USEC_PER_SEC / options->fps;
+    if (next_frame < now)
+      next_frame = now;
+  }
+}
+
+/** Queue a size command for the terminal on stdout. */
+static void daemon_append_size(FrameBuffer *out) {
+  TermSize size = get_tty_size();
+  frame_appendf(out, "size %d %d %d %d\n", size.width_cells,
+                size.height_cells, size.width_pixels, size.height_pixels);
+}
+
+int daemon_attach(const char *path) {
+  struct sockaddr_un addr;
+  if (daemon_sockaddr(&addr, path) != 0)
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  FrameBuffer out;
+  frame_init(&out);
+  for (int i = 0; daemon_env_names[i]; i++) {
+    const char *value = g_getenv(daemon_env_names[i]);
+    if (value && !strchr(value, '\n'))
+      frame_appendf(&out, "env %s=%s\n", daemon_env_names[i], value);
+  }
+  daemon_append_size(&out);
+
+  int rc = frame_flush(&out, fd);
+  int resize_fd = term_resize_watch();
+  char buf[65536];
+  while (rc == 0) {
+    struct pollfd fds[2] = {{.fd = fd, .events = POLLIN},
+                            {.fd = resize_fd, .events = POLLIN}};
+    if (poll(fds, resize_fd >= 0 ? 2 : 1, -1) < 0) {
+      rc = errno == EINTR ? 0 : -1;
+      continue;
+    }
+
+    if (resize_fd >= 0 && fds[1].revents & POLLIN &&
+        term_resize_wait(resize_fd, 0)) {
+      daemon_append_size(&out);
+      rc = frame_flush(&out, fd);
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n == 0)
+        break;
+      if (n < 0) {
+        rc = errno == EINTR ? 0 : -1;
+        continue;
+      }
+      frame_append(&out, buf, n);
+      rc = frame_flush(&out, STDOUT_FILENO);
+    }
+  }
+
+  frame_free(&out);
+  close(fd);
+  return rc;
+}
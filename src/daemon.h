@@ -0,0 +1,72 @@
+/*
+
+Daemon mode: one process polls Spotify and renders, any number of terminals
+watch.
+
+The daemon listens on a Unix socket. A client (`--attach`) connects, reports
+the environment variables terminal detection looks at plus its tty size, then
+copies whatever it receives to its stdout. Clients whose terminals come out
+the same (capabilities and geometry) share a view: one ui_ctx whose frames
+are composed once per tick and written to every client in it, so N viewers
+cost about one render.
+
+Protocol, client to daemon, one command per line:
+
+  env NAME=VALUE         part of the client's environment; send these first
+  size W H WPX HPX       tty size in cells and pixels (-1 if unknown); the
+                         first one attaches, later ones (on SIGWINCH) move
+                         the client to the view for its new size
+
+Daemon to client: raw terminal output.
+
+*/
+
+#ifndef __SNP_DAEMON_H__
+#define __SNP_DAEMON_H__
+
+#include <glib.h>
+
+#include "snapshot.h"
+#include "ui.h"
+
+/** Most clients attached at once; more are turned away. */
+#define DAEMON_MAX_CLIENTS 64
+/** Environment lines kept per client. */
+#define DAEMON_MAX_ENV 32
+/**
+ * Output queued for a client that is not reading fast enough. Past this it
+ * skips frames, then gets a full redraw once it has caught up.
+ */
+#define DAEMON_BACKLOG_MAX (4 * 1024 * 1024)
+
+typedef struct {
+  /** Frame rate views are composed at. */
+  int fps;
+  /** Renderer views are set up with. */
+  UiRenderer renderer;
+  /** Print a line per tick with how much was rendered vs. sent. */
+  gboolean show_stats;
+} DaemonOptions;
+
+/**
+ * Default socket: $XDG_RUNTIME_DIR/spotify-now-playing.sock, or one in /tmp
+ * named after the uid.
+ */
+void daemon_socket_path_default(char *dest, size_t n);
+
+/**
+ * Serve what is published to `slot` on the Unix socket at `path` (replacing
+ * a stale one). Only returns on error.
+ * @returns -1 (errno is set)
+ */
+int daemon_run(const char *path, SnapshotSlot *slot,
+               const DaemonOptions *options);
+
+/**
+ * Attach the terminal on stdin/stdout to the daemon at `path` and show its
+ * frames until it goes away.
+ * @returns 0 when the daemon closed the connection, -1 on error
+ */
+int daemon_attach(const char *path);
+
+#endif /* __SNP_DAEMON_H__ */
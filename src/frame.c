@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frame.h"
+
+void frame_init(FrameBuffer *frame) {
+  frame->data = NULL;
+  frame->len = frame->cap = 0;
+  frame->flush_syscalls = 0;
+}
+
+void frame_free(FrameBuffer *frame) {
+  free(frame->data);
+  frame_init(frame);
+}
+
+char *frame_reserve(FrameBuffer *frame, size_t size) {
+  if (frame->len + size > frame->cap) {
+    size_t cap = frame->cap ? frame->cap : 4096;
+    while (cap < frame->len + size)
+      cap *= 2;
+
+    char *data = realloc(frame->data, cap);
+    if (!data) {
+      fprintf(stderr, "out of memory growing frame to %zu bytes\n", cap);
+      exit(1);
+    }
+    frame->data = data;
+    frame->cap = cap;
+  }
+  return frame->data + frame->len;
+}
+
+void frame_commit(FrameBuffer *frame, const char *end) {
+  frame->len = end - frame->data;
+}
+
+void frame_append(FrameBuffer *frame, const char *data, size_t size) {
+  char *p = frame_reserve(frame, size);
+  memcpy(p, data, size);
+  frame->len += size;
+}
+
+void frame_appendf(FrameBuffer *frame, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int size = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+  if (size <= 0)
+    return;
+
+  // vsnprintf needs room for the terminator, which is not committed
+  char *p = frame_reserve(frame, size + 1);
+  va_start(args, fmt);
+  vsnprintf(p, size + 1, fmt, args);
+  va_end(args);
+  frame->len += size;
+}
+
+int frame_flush(FrameBuffer *frame, int fd) {
+  size_t off = 0;
+  frame->flush_syscalls = 0;
+
+  while (off < frame->len) {
+    ssize_t n = write(fd, frame->data + off, frame->len - off);
+    frame->flush_syscalls++;
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      frame_reset(frame);
+      return -1;
+    }
+    off += n;
+  }
+
+  frame_reset(frame);
+  return 0;
+}
@@ -0,0 +1,56 @@
+/*
+
+Output buffer a whole frame is composed into before it reaches the terminal.
+
+Escape sequences, styled text and image data all go into the same growable
+buffer, which is then handed to the kernel with a single write(2). The buffer
+is reused across frames, so once it has grown to fit the largest frame the
+render path stops allocating.
+
+*/
+
+#ifndef __SNP_FRAME_H__
+#define __SNP_FRAME_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+
+  /** write(2) calls made by the last frame_flush. */
+  unsigned long flush_syscalls;
+} FrameBuffer;
+
+void frame_init(FrameBuffer *frame);
+void frame_free(FrameBuffer *frame);
+
+/** Drop the contents, keeping the allocation. */
+static inline void frame_reset(FrameBuffer *frame) { frame->len = 0; }
+
+/**
+ * Make room for at least `size` more bytes.
+ * @returns pointer to the end of the frame, to write into directly; pass the
+ * new end to frame_commit afterwards
+ */
+char *frame_reserve(FrameBuffer *frame, size_t size);
+void frame_commit(FrameBuffer *frame, const char *end);
+
+void frame_append(FrameBuffer *frame, const char *data, size_t size);
+void frame_appendf(FrameBuffer *frame, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/** Append a string literal, without the trailing NUL. */
+#define frame_append_lit(frame, lit) frame_append(frame, lit, sizeof(lit) - 1)
+
+/**
+ * Write the frame to `fd` and reset it. Only a short write (e.g. a multi-MB
+ * sixel payload on a full pty) takes more than one syscall; an empty frame
+ * takes none.
+ * @returns 0 on success, -1 on error (errno is set)
+ */
+int frame_flush(FrameBuffer *frame, int fd);
+
+#endif /* __SNP_FRAME_H__ */
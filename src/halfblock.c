@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "halfblock.h"
+#include "term-util.h"
+
+#define UPPER_HALF "▀"
+#define FULL_BLOCK "█"
+/** Worst case per cell: fg and bg truecolor SGR plus a 3-byte glyph. */
+#define CELL_MAX 48
+#define ROW_END TERM_ESC "[0m"
+
+/** Colour as the terminal sees it: 0xRRGGBB, or a palette index. */
+typedef guint32 HalfblockColor;
+#define COLOR_NONE 0xffffffffu
+
+static const guint8 cube_levels[6] = {0, 95, 135, 175, 215, 255};
+
+/** Nearest of the six cube levels for each channel value. */
+static guint8 cube_index[256];
+
+static void halfblock_init_tables(void) {
+  static int done = 0;
+  if (done)
+    return;
+  for (int v = 0; v < 256; v++) {
+    int best = 0;
+    for (int i = 1; i < 6; i++)
+      if (abs(v - cube_levels[i]) < abs(v - cube_levels[best]))
+        best = i;
+    cube_index[v] = best;
+  }
+  done = 1;
+}
+
+static inline int sq(int v) { return v * v; }
+
+/** Nearest xterm colour in 16..255, whichever of cube or grey ramp is closer */
+static HalfblockColor halfblock_240(const guint8 *px) {
+  int ri = cube_index[px[0]], gi = cube_index[px[1]], bi = cube_index[px[2]];
+  int cube_d = sq(px[0] - cube_levels[ri]) + sq(px[1] - cube_levels[gi]) +
+               sq(px[2] - cube_levels[bi]);
+
+  int avg = (px[0] + px[1] + px[2]) / 3;
+  int gray = CLAMP((avg - 3) / 10, 0, 23);
+  int gray_v = 8 + gray * 10;
+  int gray_d = sq(px[0] - gray_v) + sq(px[1] - gray_v) + sq(px[2] - gray_v);
+
+  return gray_d < cube_d ? 232 + gray : 16 + ri * 36 + gi * 6 + bi;
+}
+
+static inline HalfblockColor halfblock_color(const guint8 *px,
+                                             HalfblockColors colors) {
+  if (colors == HALFBLOCK_240)
+    return halfblock_240(px);
+  return (px[0] << 16) | (px[1] << 8) | px[2];
+}
+
+static inline char *put_u8(char *p, unsigned v) {
+  if (v >= 100)
+    *p++ = '0' + v / 100;
+  if (v >= 10)
+    *p++ = '0' + v / 10 % 10;
+  *p++ = '0' + v % 10;
+  return p;
+}
+
+/** Parameters for one colour, without the CSI or the final 'm'. */
+static inline char *put_color(char *p, int bg, HalfblockColor c,
+                              HalfblockColors colors) {
+  *p++ = bg ? '4' : '3';
+  *p++ = '8';
+  *p++ = ';';
+  if (colors == HALFBLOCK_240) {
+    *p++ = '5';
+    *p++ = ';';
+    return put_u8(p, c);
+  }
+  *p++ = '2';
+  *p++ = ';';
+  p = put_u8(p, c >> 16);
+  *p++ = ';';
+  p = put_u8(p, (c >> 8) & 0xff);
+  *p++ = ';';
+  return put_u8(p, c & 0xff);
+}
+
+void halfblock_render(FrameBuffer *out, const guint8 *pixels, int width,
+                      int height, int stride, HalfblockColors colors) {
+  halfblock_init_tables();
+
+  for (int y = 0; y + 1 < height; y += 2) {
+    const guint8 *top = pixels + (size_t)y * stride;
+    const guint8 *bottom = top + stride;
+    HalfblockColor fg = COLOR_NONE, bg = COLOR_NONE;
+
+    char *p = frame_reserve(out, (size_t)width * CELL_MAX + sizeof(ROW_END));
+    if (y > 0)
+      *p++ = '\n';
+    for (int x = 0; x < width; x++, top += 3, bottom += 3) {
+      HalfblockColor t = halfblock_color(top, colors);
+      HalfblockColor b = halfblock_color(bottom, colors);
+      int set_fg = 0, set_bg = 0;
+      const char *glyph;
+
+      if (t == b) {
+        // solid cell: reuse whichever colour is already set
+        if (t == bg) {
+          glyph = " ";
+        } else if (t == fg) {
+          glyph = FULL_BLOCK;
+        } else {
+          glyph = " ";
+          set_bg = 1;
+        }
+      } else {
+        glyph = UPPER_HALF;
+        set_fg = t != fg;
+        set_bg = b != bg;
+      }
+
+      if (set_fg || set_bg) {
+        *p++ = '\033';
+        *p++ = '[';
+        if (set_fg) {
+          p = put_color(p, 0, t, colors);
+          fg = t;
+        }
+        if (set_bg) {
+          if (set_fg)
+            *p++ = ';';
+          p = put_color(p, 1, b, colors);
+          bg = b;
+        }
+        *p++ = 'm';
+      }
+      size_t glyph_len = strlen(glyph);
+      memcpy(p, glyph, glyph_len);
+      p += glyph_len;
+    }
+    memcpy(p, ROW_END, sizeof(ROW_END) - 1);
+    frame_commit(out, p + sizeof(ROW_END) - 1);
+  }
+}
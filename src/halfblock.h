@@ -0,0 +1,36 @@
+/*
+
+Native renderer for the common "upper half block" look, bypassing chafa's
+general symbol matching.
+
+Each cell shows two pixels: the top one as the foreground of U+2580 and the
+bottom one as the background. The image is expected to be exactly
+width_cells x 2 * height_cells already (scale_rgb_box does the averaging), so
+all that is left is colour conversion and emitting as few SGR bytes as
+possible: colours are only sent when they change from the previous cell, and
+solid cells are drawn with whichever of space or full block needs no change.
+
+*/
+
+#ifndef __SNP_HALFBLOCK_H__
+#define __SNP_HALFBLOCK_H__
+
+#include <glib.h>
+
+#include "frame.h"
+
+typedef enum {
+  HALFBLOCK_TRUECOLOR,
+  /** The 240 colours of the xterm cube and grey ramp (indices 16-255). */
+  HALFBLOCK_240,
+} HalfblockColors;
+
+/**
+ * Append `pixels` (packed RGB8, width x height, height even) as height / 2
+ * rows of half blocks, separated by newlines like chafa's output. Attributes
+ * are reset at the end of each row.
+ */
+void halfblock_render(FrameBuffer *out, const guint8 *pixels, int width,
+                      int height, int stride, HalfblockColors colors);
+
+#endif /* __SNP_HALFBLOCK_H__ */
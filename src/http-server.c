@@ -1,209 +1,2081 @@
 #include "http-server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-typedef struct HttpRequestQueryParam {
-  const char *key;
-  const char *value;
-  struct HttpRequestQueryParam *next;
-} HttpRequestQueryParam;
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#else
+#include <sys/event.h>
+#endif
+
+#include "frame.h"
+#include "uring.h"
+
+static const char *const http_methods[] = {
+    "GET",     "HEAD",    "POST",  "PUT",   "DELETE",
+    "CONNECT", "OPTIONS", "TRACE", "PATCH", "UNKNOWN",
+};
 
 static inline const char *http_method_to_string(HttpMethod method) {
-  static const char *strings[] = {
-      "GET",     "HEAD",    "POST",  "PUT",   "DELETE",
-      "CONNECT", "OPTIONS", "TRACE", "PATCH", "UNKNOWN",
+  return http_methods[method];
+}
+
+static HttpMethod http_method_from_span(const char *p, size_t len) {
+  for (int m = 0; m < HTTP_METHOD_UNKNOWN; m++)
+    if (strlen(http_methods[m]) == len && memcmp(http_methods[m], p, len) == 0)
+      return m;
+  return HTTP_METHOD_UNKNOWN;
+}
+
+enum {
+  HTTP_PARSE_REQUEST_LINE,
+  HTTP_PARSE_HEADERS,
+  HTTP_PARSE_FINISHED,
+  HTTP_PARSE_FAILED,
+};
+
+#define HTTP_PARAM_SLOTS_MASK (HTTP_MAX_QUERY_PARAMS * 2 - 1)
+
+_Static_assert(HTTP_CONN_BUFFER_SIZE <= 0xffff, "HttpSpan offsets are 16 bit");
+_Static_assert((HTTP_MAX_QUERY_PARAMS & (HTTP_MAX_QUERY_PARAMS - 1)) == 0,
+               "param slots are indexed with a mask");
+
+static inline HttpSpan http_span(const char *buf, const char *p, size_t len) {
+  return (HttpSpan){(unsigned short)(p - buf), (unsigned short)len};
+}
+
+static int http_hex(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/**
+ * Decode one byte of [*p, end), advancing `*p` past it. A '%' not followed
+ * by two hex digits stands for itself.
+ */
+static inline unsigned char http_decode_next(const char **p, const char *end,
+                                             int plus_is_space) {
+  char c = *(*p)++;
+  if (c == '+' && plus_is_space)
+    return ' ';
+  if (c == '%' && end - *p >= 2) {
+    int hi = http_hex((*p)[0]), lo = http_hex((*p)[1]);
+    if (hi >= 0 && lo >= 0) {
+      *p += 2;
+      return hi << 4 | lo;
+    }
+  }
+  return c;
+}
+
+size_t http_span_decode(const char *buf, HttpSpan span, int plus_is_space,
+                        char *dest, size_t n) {
+  const char *p = buf + span.off, *end = p + span.len;
+  size_t len = 0;
+  while (p < end) {
+    unsigned char c = http_decode_next(&p, end, plus_is_space);
+    if (len + 1 < n)
+      dest[len] = c;
+    len++;
+  }
+  if (n > 0)
+    dest[len < n ? len : n - 1] = 0;
+  return len;
+}
+
+/** Whether `span`, decoded, is exactly `s`. */
+static int http_span_decoded_eq(const char *buf, HttpSpan span,
+                                int plus_is_space, const char *s) {
+  const char *p = buf + span.off, *end = p + span.len;
+  while (p < end) {
+    if (!*s || http_decode_next(&p, end, plus_is_space) != (unsigned char)*s)
+      return 0;
+    s++;
+  }
+  return !*s;
+}
+
+/** FNV-1a of `span` decoded, which must match http_str_hash of the same. */
+static guint32 http_span_hash(const char *buf, HttpSpan span) {
+  const char *p = buf + span.off, *end = p + span.len;
+  guint32 h = 2166136261u;
+  while (p < end)
+    h = (h ^ http_decode_next(&p, end, 1)) * 16777619u;
+  return h;
+}
+
+static guint32 http_str_hash(const char *s) {
+  guint32 h = 2166136261u;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+static HttpParseStatus http_parse_fail(HttpRequest *request,
+                                       unsigned short code) {
+  request->error = code;
+  request->state = HTTP_PARSE_FAILED;
+  return HTTP_PARSE_ERROR;
+}
+
+/** Whether the comma-separated list [p, end) contains `token`. */
+static int http_list_has(const char *p, const char *end, const char *token) {
+  size_t token_len = strlen(token);
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+      p++;
+    const char *e = p;
+    while (e < end && *e != ',' && *e != ' ' && *e != '\t')
+      e++;
+    if ((size_t)(e - p) == token_len && strncasecmp(p, token, token_len) == 0)
+      return 1;
+    p = e;
+  }
+  return 0;
+}
+
+/** METHOD SP origin-form-target SP HTTP/1.x */
+static HttpParseStatus http_parse_request_line(HttpRequest *request,
+                                               const char *line,
+                                               const char *end) {
+  const char *buf = request->buf;
+  const char *sp = memchr(line, ' ', end - line);
+  const char *target = sp ? sp + 1 : NULL;
+  const char *version = target ? memchr(target, ' ', end - target) : NULL;
+  if (!version || sp == line || *target != '/')
+    return http_parse_fail(request, 400);
+  version++;
+  if (end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0 ||
+      (version[7] != '0' && version[7] != '1'))
+    return http_parse_fail(request, 400);
+
+  request->method = http_method_from_span(line, sp - line);
+  if (request->method == HTTP_METHOD_UNKNOWN)
+    return http_parse_fail(request, 501);
+  request->minor_version = version[7] - '0';
+
+  const char *target_end = version - 1;
+  request->target = http_span(buf, target, target_end - target);
+  const char *q = memchr(target, '?', target_end - target);
+  request->path = http_span(buf, target, (q ? q : target_end) - target);
+  request->query = q ? http_span(buf, q + 1, target_end - q - 1)
+                     : http_span(buf, target_end, 0);
+  return HTTP_PARSE_INCOMPLETE;
+}
+
+static HttpParseStatus http_parse_header(HttpRequest *request,
+                                         const char *line, const char *end) {
+  const char *buf = request->buf;
+  const char *colon = memchr(line, ':', end - line);
+  // no name, whitespace before the colon, or an obsolete line fold
+  if (!colon || colon == line || memchr(line, ' ', colon - line) ||
+      memchr(line, '\t', colon - line))
+    return http_parse_fail(request, 400);
+  if (request->n_headers == HTTP_MAX_HEADERS)
+    return http_parse_fail(request, 431);
+
+  const char *v = colon + 1, *v_end = end;
+  while (v < v_end && (*v == ' ' || *v == '\t'))
+    v++;
+  while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t'))
+    v_end--;
+
+  HttpHeader *h = &request->headers[request->n_headers++];
+  h->name = http_span(buf, line, colon - line);
+  h->value = http_span(buf, v, v_end - v);
+
+  // the few headers the server itself needs are picked out as they go by
+  size_t name_len = colon - line;
+  if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+    size_t n = 0;
+    if (v == v_end)
+      return http_parse_fail(request, 400);
+    for (const char *d = v; d < v_end; d++) {
+      if (*d < '0' || *d > '9')
+        return http_parse_fail(request, 400);
+      if (n > HTTP_CONN_BUFFER_SIZE)
+        return http_parse_fail(request, 413);
+      n = n * 10 + (*d - '0');
+    }
+    request->content_length = n;
+  } else if (name_len == 17 &&
+             strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+    return http_parse_fail(request, 501); // chunked bodies are not supported
+  } else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+    if (http_list_has(v, v_end, "close"))
+      request->keep_alive = 0;
+    else if (http_list_has(v, v_end, "keep-alive"))
+      request->keep_alive = 1;
+  }
+  return HTTP_PARSE_INCOMPLETE;
+}
+
+/** Split the query into parameters and index them by key. */
+static HttpParseStatus http_parse_query(HttpRequest *request) {
+  const char *buf = request->buf;
+  const char *p = buf + request->query.off, *end = p + request->query.len;
+  while (p < end) {
+    const char *amp = memchr(p, '&', end - p);
+    if (!amp)
+      amp = end;
+    if (amp > p) {
+      if (request->n_params == HTTP_MAX_QUERY_PARAMS)
+        return http_parse_fail(request, 414);
+      HttpQueryParam *param = &request->params[request->n_params];
+      const char *eq = memchr(p, '=', amp - p);
+      param->key = http_span(buf, p, (eq ? eq : amp) - p);
+      param->value = eq ? http_span(buf, eq + 1, amp - eq - 1)
+                        : http_span(buf, amp, 0);
+
+      // linear probing; twice as many slots as params, so one is always free
+      guint32 slot = http_span_hash(buf, param->key) & HTTP_PARAM_SLOTS_MASK;
+      while (request->param_slots[slot] >= 0)
+        slot = (slot + 1) & HTTP_PARAM_SLOTS_MASK;
+      request->param_slots[slot] = request->n_params++;
+    }
+    p = amp + 1;
+  }
+  return HTTP_PARSE_DONE;
+}
+
+void http_request_init(HttpRequest *request) {
+  memset(request, 0, sizeof(HttpRequest));
+  memset(request->param_slots, -1, sizeof(request->param_slots));
+  request->keep_alive = -1; // decided by the version unless a header says
+  request->state = HTTP_PARSE_REQUEST_LINE;
+}
+
+HttpParseStatus http_request_parse(HttpRequest *request, const char *buf,
+                                   size_t len) {
+  request->buf = buf;
+  if (request->state == HTTP_PARSE_FINISHED)
+    return HTTP_PARSE_DONE;
+  if (request->state == HTTP_PARSE_FAILED)
+    return HTTP_PARSE_ERROR;
+
+  for (;;) {
+    // only bytes that arrived since the last call are scanned
+    const char *eol =
+        memchr(buf + request->scanned, '\n', len - request->scanned);
+    if (!eol) {
+      request->scanned = len;
+      return HTTP_PARSE_INCOMPLETE;
+    }
+    const char *line = buf + request->line_start, *end = eol;
+    if (end > line && end[-1] == '\r')
+      end--;
+    request->line_start = request->scanned = eol + 1 - buf;
+
+    HttpParseStatus status;
+    if (request->state == HTTP_PARSE_REQUEST_LINE) {
+      if (end == line)
+        continue; // stray line breaks before a request are allowed
+      status = http_parse_request_line(request, line, end);
+      if (status != HTTP_PARSE_ERROR)
+        request->state = HTTP_PARSE_HEADERS;
+    } else if (end == line) {
+      request->head_len = request->line_start;
+      // 1.1 keeps the connection by default, 1.0 only when asked to
+      if (request->keep_alive < 0)
+        request->keep_alive = request->minor_version == 1;
+      status = http_parse_query(request);
+      if (status == HTTP_PARSE_DONE)
+        request->state = HTTP_PARSE_FINISHED;
+    } else {
+      status = http_parse_header(request, line, end);
+    }
+    if (status != HTTP_PARSE_INCOMPLETE)
+      return status;
+  }
+}
+
+int http_request_path_is(const HttpRequest *request, const char *path) {
+  return http_span_decoded_eq(request->buf, request->path, 0, path);
+}
+
+int http_request_query_find(const HttpRequest *request, const char *key) {
+  guint32 slot = http_str_hash(key) & HTTP_PARAM_SLOTS_MASK;
+  for (int i; (i = request->param_slots[slot]) >= 0;
+       slot = (slot + 1) & HTTP_PARAM_SLOTS_MASK)
+    if (http_span_decoded_eq(request->buf, request->params[i].key, 1, key))
+      return i;
+  return -1;
+}
+
+const char *http_request_query_get(const HttpRequest *request, const char *key,
+                                   char *dest, size_t n) {
+  int i = http_request_query_find(request, key);
+  if (i < 0)
+    return NULL;
+  http_span_decode(request->buf, request->params[i].value, 1, dest, n);
+  return dest;
+}
+
+const char *http_request_header_get(const HttpRequest *request,
+                                    const char *name, size_t *len) {
+  size_t name_len = strlen(name);
+  for (unsigned int i = 0; i < request->n_headers; i++) {
+    const HttpHeader *h = &request->headers[i];
+    if (h->name.len == name_len &&
+        strncasecmp(request->buf + h->name.off, name, name_len) == 0) {
+      *len = h->value.len;
+      return request->buf + h->value.off;
+    }
+  }
+  return NULL;
+}
+
+void http_request_print(const HttpRequest *request) {
+  printf("method: %s\n"
+         "path: %.*s\n"
+         "query: %.*s\n",
+         http_method_to_string(request->method), request->path.len,
+         request->buf + request->path.off, request->query.len,
+         request->buf + request->query.off);
+}
+
+int http_response_header(HttpResponse *response, const char *name,
+                         const char *value) {
+  if (response->n_headers == HTTP_MAX_RESPONSE_HEADERS)
+    return -1;
+  response->headers[response->n_headers++] = (HttpField){name, value};
+  return 0;
+}
+
+int http_response_headerf(HttpResponse *response, const char *name,
+                          const char *fmt, ...) {
+  char *value = response->scratch + response->scratch_len;
+  size_t room = sizeof(response->scratch) - response->scratch_len;
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(value, room, fmt, args);
+  va_end(args);
+  if (len < 0 || (size_t)len >= room ||
+      http_response_header(response, name, value) < 0)
+    return -1;
+  response->scratch_len += len + 1;
+  return 0;
+}
+
+int http_response_body_fd(HttpResponse *response, int fd, off_t offset,
+                          size_t len, void (*release)(void *),
+                          void *release_data) {
+  if (response->n_body == HTTP_MAX_BODY_SEGMENTS) {
+    if (release)
+      release(release_data);
+    return -1;
+  }
+  response->body[response->n_body++] = (HttpSegment){
+      .fd = fd,
+      .offset = offset,
+      .len = len,
+      .release = release,
+      .release_data = release_data,
   };
-  return strings[method];
-}
-
-static inline HttpMethod http_method_from_string(const char *string) {
-  switch (string[0]) {
-  case 'C':
-    return HTTP_METHOD_CONNECT;
-  case 'D':
-    return HTTP_METHOD_DELETE;
-  case 'G':
-    return HTTP_METHOD_GET;
-  case 'H':
-    return HTTP_METHOD_HEAD;
-  case 'O':
-    return HTTP_METHOD_OPTIONS;
-  case 'P':
-    switch (string[1]) {
-    case 'O':
-      return HTTP_METHOD_POST;
-    case 'U':
-      return HTTP_METHOD_PUT;
-    case 'A':
-      return HTTP_METHOD_PATCH;
+  return 0;
+}
+
+int http_response_body(HttpResponse *response, const void *data, size_t len,
+                       void (*release)(void *), void *release_data) {
+  if (http_response_body_fd(response, -1, 0, len, release, release_data) < 0)
+    return -1;
+  response->body[response->n_body - 1].data = data;
+  return 0;
+}
+
+int http_response_printf(HttpResponse *response, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  char *text = g_strdup_vprintf(fmt, args);
+  va_end(args);
+  return http_response_body(response, text, strlen(text), g_free, text);
+}
+
+/*
+ * Event queue: epoll on Linux, kqueue on macOS and the BSDs. Both are used
+ * edge-triggered, with every fd registered once for reads and writes, so
+ * whoever handles an event must read or write until EAGAIN.
+ */
+
+#define HTTP_EVENTS_MAX 256
+
+/** What an event is for: a connection, the listener or the wake pipe. */
+typedef void *HttpEvent;
+
+#ifdef __linux__
+typedef struct epoll_event HttpRawEvent;
+
+static int http_queue_new(void) { return epoll_create1(EPOLL_CLOEXEC); }
+
+static int http_queue_add(int queue, int fd, void *data) {
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                           .data.ptr = data};
+  return epoll_ctl(queue, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void http_queue_del(int queue, int fd) {
+  epoll_ctl(queue, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int http_queue_wait(int queue, HttpRawEvent *raw, HttpEvent *events,
+                           int timeout_ms) {
+  int n = epoll_wait(queue, raw, HTTP_EVENTS_MAX, timeout_ms);
+  // errors and hangups surface as a failed read or write
+  for (int i = 0; i < n; i++)
+    events[i] = raw[i].data.ptr;
+  return n;
+}
+#else
+typedef struct kevent HttpRawEvent;
+
+static int http_queue_new(void) { return kqueue(); }
+
+static int http_queue_add(int queue, int fd, void *data) {
+  struct kevent ev[2];
+  EV_SET(&ev[0], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, data);
+  EV_SET(&ev[1], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, data);
+  return kevent(queue, ev, 2, NULL, 0, NULL);
+}
+
+static void http_queue_del(int queue, int fd) {
+  struct kevent ev[2];
+  EV_SET(&ev[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  EV_SET(&ev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+  kevent(queue, ev, 2, NULL, 0, NULL);
+}
+
+static int http_queue_wait(int queue, HttpRawEvent *raw, HttpEvent *events,
+                           int timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  int n = kevent(queue, NULL, 0, raw, HTTP_EVENTS_MAX,
+                 timeout_ms < 0 ? NULL : &ts);
+  for (int i = 0; i < n; i++)
+    events[i] = raw[i].udata;
+  return n;
+}
+#endif
+
+typedef enum {
+  HTTP_CONN_READING,
+  HTTP_CONN_WRITING,
+  /** Subscribed to events; the request side is only read to notice EOF. */
+  HTTP_CONN_STREAMING,
+} HttpConnState;
+
+/** A broadcast event, serialized once and shared by every subscriber. */
+typedef struct {
+  /** Only touched on the server thread. */
+  unsigned int refs;
+  size_t len;
+  char data[];
+} HttpEventMsg;
+
+static void http_event_unref(HttpEventMsg *msg) {
+  if (msg && --msg->refs == 0)
+    free(msg);
+}
+
+typedef struct HttpConn {
+  int fd;
+  HttpConnState state;
+
+  /** Received bytes not yet handled; may hold pipelined requests. */
+  char in[HTTP_CONN_BUFFER_SIZE];
+  size_t in_len;
+  /** The request at the front of `in`, parsed as far as it has arrived. */
+  HttpRequest request;
+
+  /**
+   * Response head (or a chunk of a streamed body) and how much of it the
+   * kernel has taken, then the body segments, the current one `seg_sent` in,
+   * then the body read from `stream` until EOF, if any.
+   */
+  FrameBuffer out;
+  size_t out_sent;
+  HttpSegment segs[HTTP_MAX_BODY_SEGMENTS * 3];
+  unsigned int n_segs, seg_i;
+  size_t seg_sent;
+  /** Chunk sizes, for the known-length segments of a chunked body. */
+  char chunk_sizes[HTTP_MAX_BODY_SEGMENTS][20];
+  HttpSegment stream;
+  int chunked;
+
+  int keep_alive;
+  /** Stop the server once this response is out (the handler asked to). */
+  int stop_after;
+  /** Turn into a subscriber once the response head is out. */
+  int subscribe;
+
+  /**
+   * Event being written and how far, and the one to write after it. Events
+   * are whole states, so a newer one simply replaces `ev_next`: a slow
+   * subscriber skips to the latest instead of queueing up.
+   */
+  HttpEventMsg *ev_cur, *ev_next;
+  size_t ev_sent;
+
+  /** Idle list (least recently active first) or subscriber list. */
+  gint64 last_active;
+  struct HttpConn *prev, *next;
+
+#ifdef SNP_HAVE_IO_URING
+  /**
+   * io_uring backend: kinds of operation in flight (HTTP_OP_* bits) and
+   * completions still to come; a closed connection is only reused once the
+   * last has arrived.
+   */
+  unsigned int ops_armed;
+  unsigned int ops;
+  /** The fd a linked IORING_OP_CLOSE owns, or -1. */
+  int ring_close_fd;
+  /** What the sendmsg in flight sends. */
+  struct msghdr msg;
+  struct iovec iov[1 + HTTP_MAX_BODY_SEGMENTS * 3];
+#endif
+} HttpConn;
+
+typedef struct {
+  HttpConn *head, *tail;
+} HttpConnList;
+
+struct HttpServer {
+  HttpBackend backend;
+  int listener;
+  /** Readiness queue; -1 with io_uring. */
+  int queue;
+  /** Self-pipe http_server_stop writes to, to wake up the event loop. */
+  int wake[2];
+  unsigned short port;
+
+  HttpHandler handler;
+  void *user_data;
+
+  atomic_int stop;
+  unsigned int n_conns;
+  HttpConnList idle;
+  HttpConnList subscribers;
+  /** Closed connections kept for reuse, linked through `next`. */
+  HttpConn *spare;
+  /**
+   * accept ran out of fds and left connections in the backlog; `accept_retry`
+   * is set once one has been freed since.
+   */
+  int accept_paused;
+  int accept_retry;
+
+  /** Handed over by http_server_broadcast; guarded by `lock`. */
+  pthread_mutex_t lock;
+  HttpEventMsg *incoming;
+  /** Last event broadcast, sent to new subscribers first. */
+  HttpEventMsg *latest;
+  /** Comment line sent to quiet subscribers, to notice dead peers. */
+  HttpEventMsg *heartbeat;
+  gint64 heartbeat_at;
+
+#ifdef SNP_HAVE_IO_URING
+  Uring ring;
+  /** Receive buffers shared by all connections. */
+  UringBufRing bufs;
+  int ring_enabled;
+  /** Closed, but with completions still to come. */
+  HttpConnList closing;
+  /** Whether the multishot accept is in flight; else when to try again. */
+  int accept_armed;
+  gint64 accept_resume_at;
+#endif
+};
+
+static void http_set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void http_list_unlink(HttpConnList *list, HttpConn *conn) {
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    list->head = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  else
+    list->tail = conn->prev;
+  conn->prev = conn->next = NULL;
+}
+
+static void http_list_append(HttpConnList *list, HttpConn *conn) {
+  conn->prev = list->tail;
+  conn->next = NULL;
+  if (list->tail)
+    list->tail->next = conn;
+  else
+    list->head = conn;
+  list->tail = conn;
+}
+
+static HttpConnList *http_conn_list(HttpServer *server, HttpConn *conn) {
+  return conn->state == HTTP_CONN_STREAMING ? &server->subscribers
+                                            : &server->idle;
+}
+
+/** Mark activity on `conn`, moving it to the back of the idle list. */
+static void http_conn_touch(HttpServer *server, HttpConn *conn, gint64 now) {
+  conn->last_active = now;
+  if (conn->state != HTTP_CONN_STREAMING && server->idle.tail != conn) {
+    http_list_unlink(&server->idle, conn);
+    http_list_append(&server->idle, conn);
+  }
+}
+
+/** Queue `msg` on subscriber `conn`, superseding any event still waiting. */
+static void http_conn_push(HttpConn *conn, HttpEventMsg *msg) {
+  msg->refs++;
+  if (!conn->ev_cur) {
+    conn->ev_cur = msg;
+    conn->ev_sent = 0;
+  } else {
+    http_event_unref(conn->ev_next);
+    conn->ev_next = msg;
+  }
+}
+
+static void http_segment_release(HttpSegment *seg) {
+  if (seg->release)
+    seg->release(seg->release_data);
+  seg->release = NULL;
+}
+
+/** Have the streamed body's source drive `conn` too, when it polls. */
+static void http_stream_watch(HttpServer *server, HttpConn *conn) {
+  if (server->queue >= 0)
+    http_queue_add(server->queue, conn->stream.fd, conn);
+}
+
+/** Done with the streamed body. */
+static void http_stream_close(HttpServer *server, HttpConn *conn) {
+  if (server->queue >= 0)
+    http_queue_del(server->queue, conn->stream.fd);
+  http_segment_release(&conn->stream);
+  conn->stream.fd = -1;
+}
+
+/** Let go of whatever is left of the body being sent. */
+static void http_conn_release_body(HttpServer *server, HttpConn *conn) {
+  for (; conn->seg_i < conn->n_segs; conn->seg_i++)
+    http_segment_release(&conn->segs[conn->seg_i]);
+  conn->n_segs = conn->seg_i = 0;
+  conn->seg_sent = 0;
+  if (conn->stream.fd >= 0)
+    http_stream_close(server, conn);
+}
+
+#ifdef SNP_HAVE_IO_URING
+static void http_uring_close(HttpServer *server, HttpConn *conn);
+#endif
+
+static void http_conn_close(HttpServer *server, HttpConn *conn) {
+  if (conn->stop_after)
+    atomic_store(&server->stop, 1);
+
+  http_conn_release_body(server, conn);
+  http_list_unlink(http_conn_list(server, conn), conn);
+  http_event_unref(conn->ev_cur);
+  http_event_unref(conn->ev_next);
+  conn->ev_cur = conn->ev_next = NULL;
+  server->n_conns--;
+  server->accept_retry = server->accept_paused;
+#ifdef SNP_HAVE_IO_URING
+  if (server->backend == HTTP_BACKEND_IO_URING) {
+    http_uring_close(server, conn);
+    return;
+  }
+#endif
+  close(conn->fd); // also drops it from the event queue
+  conn->fd = -1;
+
+  conn->next = server->spare;
+  server->spare = conn;
+}
+
+/**
+ * Take on accepted socket `fd`.
+ * @returns NULL if there is no room for it (`fd` is closed then)
+ */
+static HttpConn *http_conn_new(HttpServer *server, int fd, gint64 now) {
+  if (server->n_conns >= HTTP_MAX_CONNECTIONS) {
+    close(fd);
+    return NULL;
+  }
+
+  int enable = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+  HttpConn *conn = server->spare;
+  if (conn) {
+    server->spare = conn->next;
+  } else {
+    conn = malloc(sizeof(HttpConn));
+    if (!conn) {
+      close(fd);
+      return NULL;
     }
+    frame_init(&conn->out);
+  }
+  conn->fd = fd;
+  conn->state = HTTP_CONN_READING;
+  conn->in_len = 0;
+  http_request_init(&conn->request);
+  frame_reset(&conn->out);
+  conn->out_sent = 0;
+  conn->n_segs = conn->seg_i = 0;
+  conn->stream.fd = -1;
+  conn->keep_alive = 0;
+  conn->stop_after = 0;
+  conn->subscribe = 0;
+  conn->ev_cur = conn->ev_next = NULL;
+#ifdef SNP_HAVE_IO_URING
+  conn->ops_armed = conn->ops = 0;
+  conn->ring_close_fd = -1;
+#endif
+  conn->last_active = now;
+  http_list_append(&server->idle, conn);
+  server->n_conns++;
+  return conn;
+}
+
+static void http_accept(HttpServer *server, gint64 now) {
+  server->accept_retry = 0;
+  for (;;) {
+    int fd = accept(server->listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno == EMFILE || errno == ENFILE) {
+        // the listener stays readable with no new edge: try again once a
+        // connection has given its fd back
+        if (!server->accept_paused)
+          perror("accept");
+        server->accept_paused = 1;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        server->accept_paused = 0;
+      } else {
+        perror("accept");
+      }
+      return;
+    }
+
+    http_set_nonblocking(fd);
+    HttpConn *conn = http_conn_new(server, fd, now);
+    if (conn && http_queue_add(server->queue, fd, conn) < 0) {
+      perror("http_queue_add");
+      http_conn_close(server, conn);
+    }
+  }
+}
+
+static const char *http_status_reason(unsigned short code) {
+  switch (code) {
+  case 200:
+    return "OK";
+  case 204:
+    return "No Content";
+  case 304:
+    return "Not Modified";
+  case 400:
+    return "Bad Request";
+  case 401:
+    return "Unauthorized";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 413:
+    return "Content Too Large";
+  case 414:
+    return "URI Too Long";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 500:
+    return "Internal Server Error";
+  case 501:
+    return "Not Implemented";
+  case 503:
+    return "Service Unavailable";
+  }
+  return "";
+}
+
+static const char http_crlf[] = "\r\n";
+
+/**
+ * Queue `response` on `conn`, taking over its body segments; the body is
+ * left out (but still measured) for HEAD requests.
+ */
+static void http_conn_respond(HttpServer *server, HttpConn *conn,
+                              HttpResponse *response, int head_only) {
+  // these never have a body, whatever the request
+  int bodiless = response->code == 204 || response->code == 304;
+  if (bodiless)
+    head_only = 1;
+
+  size_t body_len = 0;
+  int to_eof = 0;
+  for (unsigned int i = 0; i < response->n_body; i++) {
+    if (response->body[i].len == HTTP_LENGTH_TO_EOF)
+      to_eof = 1;
+    else
+      body_len += response->body[i].len;
+  }
+
+  frame_appendf(&conn->out, "HTTP/1.1 %u %s\r\n", response->code,
+                http_status_reason(response->code));
+  if (response->content_type)
+    frame_appendf(&conn->out, "Content-Type: %s\r\n", response->content_type);
+  for (unsigned int i = 0; i < response->n_headers; i++)
+    frame_appendf(&conn->out, "%s: %s\r\n", response->headers[i].name,
+                  response->headers[i].value);
+
+  // a body of unknown length is chunked for 1.1, or ends with the connection
+  conn->chunked = !bodiless && to_eof && conn->request.minor_version == 1;
+  if (conn->chunked)
+    frame_append_lit(&conn->out, "Transfer-Encoding: chunked\r\n");
+  else if (bodiless)
+    ; // no framing at all
+  else if (to_eof)
+    conn->keep_alive = 0;
+  else
+    frame_appendf(&conn->out, "Content-Length: %zu\r\n", body_len);
+  frame_appendf(&conn->out, "Connection: %s\r\n\r\n",
+                conn->keep_alive ? "keep-alive" : "close");
+  conn->state = HTTP_CONN_WRITING;
+
+  conn->n_segs = conn->seg_i = 0;
+  conn->seg_sent = 0;
+  for (unsigned int i = 0; i < response->n_body; i++) {
+    HttpSegment *seg = &response->body[i];
+    if (head_only) {
+      http_segment_release(seg);
+    } else if (seg->len == HTTP_LENGTH_TO_EOF) {
+      conn->stream = *seg;
+      // a pipe may run dry; its events drive the connection like its own
+      http_stream_watch(server, conn);
+    } else if (conn->chunked) {
+      if (seg->len == 0) {
+        http_segment_release(seg);
+        continue; // a zero-size chunk would end the body
+      }
+      char *size = conn->chunk_sizes[i];
+      int size_len = snprintf(size, sizeof(conn->chunk_sizes[i]), "%zx\r\n",
+                              seg->len);
+      conn->segs[conn->n_segs++] =
+          (HttpSegment){.data = size, .fd = -1, .len = size_len};
+      conn->segs[conn->n_segs++] = *seg;
+      conn->segs[conn->n_segs++] =
+          (HttpSegment){.data = http_crlf, .fd = -1, .len = 2};
+    } else {
+      conn->segs[conn->n_segs++] = *seg;
+    }
+  }
+  response->n_body = 0;
+}
+
+/** Start an event stream on `conn`; events follow once this is sent. */
+static void http_conn_respond_stream(HttpConn *conn, HttpResponse *response) {
+  for (unsigned int i = 0; i < response->n_body; i++)
+    http_segment_release(&response->body[i]);
+
+  // no Content-Length: the stream lasts until either side closes
+  frame_append_lit(&conn->out, "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/event-stream\r\n"
+                               "Cache-Control: no-cache\r\n"
+                               "\r\n");
+  conn->subscribe = 1;
+  conn->keep_alive = 0;
+  conn->state = HTTP_CONN_WRITING;
+}
+
+/** Reply with a bare error status and close once it is sent. */
+static void http_conn_fail(HttpServer *server, HttpConn *conn,
+                           unsigned short code) {
+  HttpResponse response = {.code = code, .content_type = "text/plain"};
+  conn->keep_alive = 0;
+  conn->in_len = 0;
+  http_request_init(&conn->request);
+  http_conn_respond(server, conn, &response, 0);
+}
+
+/**
+ * Handle the request at the front of `conn->in`, if it is complete.
+ * @returns TRUE if a response was queued
+ */
+static gboolean http_conn_handle(HttpServer *server, HttpConn *conn) {
+  HttpRequest *request = &conn->request;
+  switch (http_request_parse(request, conn->in, conn->in_len)) {
+  case HTTP_PARSE_INCOMPLETE:
+    if (conn->in_len < sizeof(conn->in))
+      return FALSE;
+    http_conn_fail(server, conn, request->target.len ? 431 : 414);
+    return TRUE;
+  case HTTP_PARSE_ERROR:
+    http_conn_fail(server, conn, request->error);
+    return TRUE;
+  case HTTP_PARSE_DONE:
     break;
-  case 'T':
-    return HTTP_METHOD_TRACE;
   }
-  return HTTP_METHOD_UNKNOWN;
+
+  if (request->content_length > sizeof(conn->in) - request->head_len) {
+    http_conn_fail(server, conn, 413);
+    return TRUE;
+  }
+  size_t message_len = request->head_len + request->content_length;
+  if (conn->in_len < message_len)
+    return FALSE;
+  conn->keep_alive = request->keep_alive;
+
+  HttpResponse response = {.code = 404, .content_type = "text/html"};
+  if (server->handler(request, &response, server->user_data)) {
+    conn->stop_after = 1;
+    conn->keep_alive = 0;
+  }
+  if (response.subscribe && response.code == 200 &&
+      request->method == HTTP_METHOD_GET)
+    http_conn_respond_stream(conn, &response);
+  else
+    http_conn_respond(server, conn, &response,
+                      request->method == HTTP_METHOD_HEAD);
+
+  conn->in_len -= message_len;
+  memmove(conn->in, conn->in + message_len, conn->in_len);
+  http_request_init(request);
+  return TRUE;
+}
+
+#ifdef MSG_NOSIGNAL
+#define HTTP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define HTTP_SEND_FLAGS 0
+#endif
+
+/**
+ * Write `data[*sent..len)` to `conn`, advancing `*sent`.
+ * @returns 1 once all of it is out, 0 if the socket is full, -1 on error
+ */
+static int http_conn_send(HttpConn *conn, const char *data, size_t len,
+                          size_t *sent) {
+  while (*sent < len) {
+    ssize_t n = send(conn->fd, data + *sent, len - *sent, HTTP_SEND_FLAGS);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    *sent += n;
+  }
+  return 1;
+}
+
+/** Bytes of `fd` from `offset` to socket `sock`, without a copy to user space. */
+static ssize_t http_sendfile(int sock, int fd, off_t offset, size_t len) {
+#if defined(__linux__)
+  return sendfile(sock, fd, &offset, len);
+#elif defined(__APPLE__)
+  off_t sent = len;
+  int ret = sendfile(fd, sock, offset, &sent, NULL, 0);
+  // a partial send on a full socket still reports EAGAIN
+  return ret < 0 && sent == 0 ? -1 : sent;
+#elif defined(__FreeBSD__)
+  off_t sent = 0;
+  int ret = sendfile(fd, sock, offset, len, NULL, &sent, 0);
+  return ret < 0 && sent == 0 ? -1 : sent;
+#else
+  char buf[16384];
+  ssize_t n = pread(fd, buf, MIN(len, sizeof(buf)), offset);
+  return n <= 0 ? n : send(sock, buf, n, HTTP_SEND_FLAGS);
+#endif
 }
 
-/** WARNING: MODIFIES PROVIDED BUFFER */
-HttpRequest *http_request_parse_message(char *message) {
-  HttpRequest *out = malloc(sizeof(HttpRequest));
-  char *first_line = strtok(message, "\r\n");
+/** Account for `n` bytes written from the head and memory segments. */
+static void http_conn_consume(HttpConn *conn, size_t n) {
+  size_t head = MIN(n, conn->out.len - conn->out_sent);
+  conn->out_sent += head;
+  n -= head;
 
-  char *method = strtok(first_line, " ");
-  char *location = strtok(NULL, " ");
+  while (conn->seg_i < conn->n_segs && conn->segs[conn->seg_i].fd < 0) {
+    HttpSegment *seg = &conn->segs[conn->seg_i];
+    size_t left = seg->len - conn->seg_sent;
+    if (n < left) {
+      conn->seg_sent += n;
+      return;
+    }
+    n -= left;
+    http_segment_release(seg);
+    conn->seg_i++;
+    conn->seg_sent = 0;
+  }
+}
 
-  out->method = http_method_from_string(method);
+/** Bytes read from a streamed body per chunk. */
+#define HTTP_STREAM_PIECE 16384
+/** Room left in front of a piece for its chunk size line. */
+#define HTTP_CHUNK_SIZE_ROOM 8
 
-  char *path = strtok(location, "?");
-  strcpy(out->path, path);
+/**
+ * Read the next piece of the streamed body into `out`, framed as a chunk if
+ * the body is chunked, or the end of the body at EOF.
+ * @returns 1 if there is something to send, 0 if the source has nothing yet,
+ * -1 on error
+ */
+static int http_conn_stream_piece(HttpServer *server, HttpConn *conn) {
+  frame_reset(&conn->out);
+  char *p = frame_reserve(&conn->out,
+                          HTTP_CHUNK_SIZE_ROOM + HTTP_STREAM_PIECE + 2);
+  ssize_t n;
+  do
+    n = read(conn->stream.fd, p + HTTP_CHUNK_SIZE_ROOM, HTTP_STREAM_PIECE);
+  while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
 
-  char *query = strtok(NULL, "");
-  if (query) {
-    strcpy(out->__query, query);
-    query = out->__query;
+  if (n == 0) {
+    http_stream_close(server, conn);
+    conn->out_sent = 0;
+    if (conn->chunked)
+      frame_append_lit(&conn->out, "0\r\n\r\n");
+    return 1;
+  }
 
-    HttpRequestQueryParam head;
-    HttpRequestQueryParam *prev = &head;
-    HttpRequestQueryParam *new;
+  conn->out_sent = HTTP_CHUNK_SIZE_ROOM;
+  frame_commit(&conn->out, p + HTTP_CHUNK_SIZE_ROOM + n);
+  if (conn->chunked) {
+    char size[HTTP_CHUNK_SIZE_ROOM + 1];
+    int size_len = snprintf(size, sizeof(size), "%zx\r\n", (size_t)n);
+    conn->out_sent -= size_len;
+    memcpy(p + conn->out_sent, size, size_len);
+    frame_append(&conn->out, http_crlf, 2);
+  }
+  return 1;
+}
 
-    for (char *segment = strtok(query, "&"); segment != NULL;
-         segment = strtok(NULL, "&")) {
-      new = malloc(sizeof(HttpRequestQueryParam));
-      char *key = segment;
-      new->key = key;
-      char *value = strchr(key, '=');
-      if (value != NULL) {
-        value[0] = 0;
-        value += 1;
-        new->value = value;
-      } else {
-        new->value = key + sizeof(key);
+#define HTTP_IOV_MAX 64
+
+/**
+ * Send the queued response: head and memory segments gathered into one
+ * writev, file segments with sendfile, then any streamed body.
+ * @returns 1 once all of it is out, 0 if the socket (or the streamed body's
+ * source) is not ready, -1 on error
+ */
+static int http_conn_send_response(HttpServer *server, HttpConn *conn) {
+  for (;;) {
+    struct iovec iov[HTTP_IOV_MAX];
+    int n_iov = 0;
+    if (conn->out_sent < conn->out.len)
+      iov[n_iov++] = (struct iovec){conn->out.data + conn->out_sent,
+                                    conn->out.len - conn->out_sent};
+    for (unsigned int i = conn->seg_i;
+         i < conn->n_segs && conn->segs[i].fd < 0 && n_iov < HTTP_IOV_MAX;
+         i++) {
+      size_t skip = i == conn->seg_i ? conn->seg_sent : 0;
+      iov[n_iov++] = (struct iovec){(char *)conn->segs[i].data + skip,
+                                    conn->segs[i].len - skip};
+    }
+
+    ssize_t n;
+    if (n_iov > 0) {
+      struct msghdr msg = {.msg_iov = iov, .msg_iovlen = n_iov};
+      n = sendmsg(conn->fd, &msg, HTTP_SEND_FLAGS);
+      if (n >= 0) {
+        http_conn_consume(conn, n);
+        continue;
       }
-      prev->next = new;
-      prev = new;
+    } else if (conn->seg_i < conn->n_segs) {
+      HttpSegment *seg = &conn->segs[conn->seg_i];
+      n = http_sendfile(conn->fd, seg->fd, seg->offset + conn->seg_sent,
+                        seg->len - conn->seg_sent);
+      if (n == 0)
+        return -1; // the file is shorter than the segment said
+      if (n > 0) {
+        conn->seg_sent += n;
+        if (conn->seg_sent == seg->len) {
+          http_segment_release(seg);
+          conn->seg_i++;
+          conn->seg_sent = 0;
+        }
+        continue;
+      }
+    } else if (conn->stream.fd >= 0) {
+      int ready = http_conn_stream_piece(server, conn);
+      if (ready <= 0)
+        return ready;
+      continue;
+    } else {
+      frame_reset(&conn->out);
+      conn->out_sent = 0;
+      conn->n_segs = conn->seg_i = 0;
+      return 1;
     }
-    out->query = head.next;
-  } else {
-    out->query = NULL;
+
+    if (errno == EINTR)
+      continue;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
   }
-  return out;
 }
 
-void http_request_free(HttpRequest *req) {
-  if (req == NULL)
+/** Move `conn` from the idle list to the subscribers. */
+static void http_conn_subscribe(HttpServer *server, HttpConn *conn) {
+  http_list_unlink(&server->idle, conn);
+  conn->state = HTTP_CONN_STREAMING;
+  http_list_append(&server->subscribers, conn);
+  if (server->latest)
+    http_conn_push(conn, server->latest);
+}
+
+/**
+ * Move on from a response that is completely sent.
+ * @returns FALSE if the connection is to be closed
+ */
+static gboolean http_conn_sent(HttpServer *server, HttpConn *conn) {
+  if (conn->subscribe)
+    http_conn_subscribe(server, conn);
+  else if (conn->keep_alive)
+    conn->state = HTTP_CONN_READING;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+/**
+ * Move `conn` along as far as it goes without blocking: write out what is
+ * queued, then read and handle requests until the socket runs dry. Returning
+ * only on EAGAIN keeps the edge-triggered events armed.
+ * @returns FALSE if the connection was closed
+ */
+static gboolean http_conn_drive(HttpServer *server, HttpConn *conn) {
+  for (;;) {
+    int done;
+    if (conn->state == HTTP_CONN_WRITING) {
+      done = http_conn_send_response(server, conn);
+      if (done == 0)
+        return TRUE;
+      if (done < 0 || !http_conn_sent(server, conn))
+        break;
+    }
+
+    if (conn->state == HTTP_CONN_STREAMING) {
+      while (conn->ev_cur) {
+        done = http_conn_send(conn, conn->ev_cur->data, conn->ev_cur->len,
+                              &conn->ev_sent);
+        if (done == 0)
+          return TRUE;
+        if (done < 0)
+          goto close;
+        http_event_unref(conn->ev_cur);
+        conn->ev_cur = conn->ev_next;
+        conn->ev_next = NULL;
+        conn->ev_sent = 0;
+      }
+      // nothing is expected from a subscriber; reading only notices EOF
+      conn->in_len = 0;
+    } else if (http_conn_handle(server, conn)) {
+      // pipelined requests may already be waiting
+      continue;
+    }
+
+    ssize_t n = read(conn->fd, conn->in + conn->in_len,
+                     sizeof(conn->in) - conn->in_len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return TRUE;
+    if (n <= 0)
+      break;
+    conn->in_len += n;
+  }
+
+close:
+  http_conn_close(server, conn);
+  return FALSE;
+}
+
+#ifdef SNP_HAVE_IO_URING
+/*
+ * io_uring backend. The connection state machines are the same as above;
+ * what changes is that the ring does the reading and most of the writing,
+ * and says so with a completion, instead of the loop doing it on readiness.
+ *
+ * Completions carry the connection (or the server) with the kind of
+ * operation in the low bits: both are allocated, so those bits are free.
+ */
+
+/** Submission queue entries. */
+#define HTTP_URING_ENTRIES 4096
+/** Receive buffers shared by all connections (a power of two), and size. */
+#define HTTP_URING_BUFS 512
+#define HTTP_URING_BUF_SIZE 4096
+#define HTTP_URING_BUF_GROUP 0
+/** How long accepting rests at the fd limit, unless a connection closes. */
+#define HTTP_URING_ACCEPT_BACKOFF_MS 100
+
+enum {
+  HTTP_OP_RECV = 1,
+  HTTP_OP_SEND,
+  HTTP_OP_POLL,
+  HTTP_OP_CLOSE,
+  HTTP_OP_CANCEL,
+  HTTP_OP_ACCEPT, // on the server
+  HTTP_OP_WAKE,   // on the server
+};
+#define HTTP_OP_MASK 7
+
+static inline __u64 http_op_data(void *p, int op) {
+  return (__u64)(uintptr_t)p | op;
+}
+
+/** Queue operation `op` on `conn`; the caller fills in the rest. */
+static struct io_uring_sqe *http_uring_op(HttpServer *server, HttpConn *conn,
+                                          int op) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  if (!sqe)
+    return NULL;
+  sqe->user_data = http_op_data(conn, op);
+  conn->ops++;
+  if (op != HTTP_OP_CANCEL)
+    conn->ops_armed |= 1u << op;
+  return sqe;
+}
+
+/** Receive into provided buffers until the peer or an error stops it. */
+static int http_uring_recv(HttpServer *server, HttpConn *conn) {
+  struct io_uring_sqe *sqe = http_uring_op(server, conn, HTTP_OP_RECV);
+  if (!sqe)
+    return -1;
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = HTTP_URING_BUF_GROUP;
+  return 0;
+}
+
+/** Wait once for `events` on `fd`, for what still goes out on readiness. */
+static int http_uring_poll(HttpServer *server, HttpConn *conn, int fd,
+                           unsigned int events) {
+  struct io_uring_sqe *sqe = http_uring_op(server, conn, HTTP_OP_POLL);
+  if (!sqe)
+    return -1;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  return 0;
+}
+
+/** Cancel `op` on `conn`, if it is in flight. */
+static void http_uring_cancel(HttpServer *server, HttpConn *conn, int op) {
+  if (!(conn->ops_armed & (1u << op)))
     return;
+  struct io_uring_sqe *sqe = http_uring_op(server, conn, HTTP_OP_CANCEL);
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = http_op_data(conn, op);
+}
+
+/**
+ * Close `fd` of `conn` through the ring, behind whatever is queued on it: an
+ * fd closed here could be reused before those reach the kernel.
+ */
+static void http_uring_close_fd(HttpServer *server, HttpConn *conn, int fd) {
+  struct io_uring_sqe *sqe = http_uring_op(server, conn, HTTP_OP_CLOSE);
+  if (!sqe) {
+    uring_submit_and_wait(&server->ring, 0, -1);
+    close(fd);
+    return;
+  }
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+  conn->ring_close_fd = fd;
+}
+
+/** Whether the response is all in memory, so the ring can send all of it. */
+static gboolean http_conn_in_memory(const HttpConn *conn) {
+  if (conn->stream.fd >= 0)
+    return FALSE;
+  for (unsigned int i = conn->seg_i; i < conn->n_segs; i++)
+    if (conn->segs[i].fd >= 0)
+      return FALSE;
+  return TRUE;
+}
+
+/**
+ * Send the head and memory segments of the response in one sendmsg. When
+ * the connection ends with it, stop receiving and close right behind it.
+ */
+static int http_uring_sendmsg(HttpServer *server, HttpConn *conn) {
+  int n_iov = 0;
+  if (conn->out_sent < conn->out.len)
+    conn->iov[n_iov++] =
+        (struct iovec){conn->out.data + conn->out_sent,
+                       conn->out.len - conn->out_sent};
+  for (unsigned int i = conn->seg_i; i < conn->n_segs; i++) {
+    const HttpSegment *seg = &conn->segs[i];
+    size_t skip = i == conn->seg_i ? conn->seg_sent : 0;
+    if (seg->len > skip)
+      conn->iov[n_iov++] =
+          (struct iovec){(char *)seg->data + skip, seg->len - skip};
+  }
+  conn->msg = (struct msghdr){.msg_iov = conn->iov, .msg_iovlen = n_iov};
+
+  gboolean last = !conn->keep_alive && !conn->subscribe;
+  // the cancel, send and close must go in one submission to stay linked
+  if (uring_reserve(&server->ring, 3) < 0)
+    return -1;
+  if (last)
+    http_uring_cancel(server, conn, HTTP_OP_RECV);
+  struct io_uring_sqe *sqe = http_uring_op(server, conn, HTTP_OP_SEND);
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = conn->fd;
+  sqe->addr = (uintptr_t)&conn->msg;
+  sqe->msg_flags = MSG_WAITALL | HTTP_SEND_FLAGS;
+  if (last) {
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe = http_uring_op(server, conn, HTTP_OP_CLOSE);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->fd;
+    conn->ring_close_fd = conn->fd;
+  }
+  return 0;
+}
+
+/** Send the rest of the event at the head of a subscriber's queue. */
+static int http_uring_send_event(HttpServer *server, HttpConn *conn) {
+  struct io_uring_sqe *sqe = http_uring_op(server, conn, HTTP_OP_SEND);
+  if (!sqe)
+    return -1;
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = conn->fd;
+  sqe->addr = (uintptr_t)(conn->ev_cur->data + conn->ev_sent);
+  sqe->len = conn->ev_cur->len - conn->ev_sent;
+  sqe->msg_flags = MSG_WAITALL | HTTP_SEND_FLAGS;
+  return 0;
+}
+
+/**
+ * Move `conn` along with what has arrived: handle requests, and start
+ * sending whatever is due, one send at a time.
+ */
+static void http_uring_progress(HttpServer *server, HttpConn *conn) {
+  const unsigned int writing = 1u << HTTP_OP_SEND | 1u << HTTP_OP_POLL |
+                               1u << HTTP_OP_CLOSE;
+  for (;;) {
+    if (conn->ops_armed & writing)
+      return;
 
-  HttpRequestQueryParam *curr = req->query;
-  HttpRequestQueryParam *next;
-  while (curr) {
-    next = curr->next;
-    free(curr);
-    curr = next;
+    if (conn->state == HTTP_CONN_WRITING) {
+      if (http_conn_in_memory(conn)) {
+        if (http_uring_sendmsg(server, conn) < 0)
+          break;
+        return;
+      }
+      // files and streams are sent as the readiness backend does
+      int done = http_conn_send_response(server, conn);
+      if (done < 0)
+        break;
+      if (done == 0) {
+        gboolean source = conn->stream.fd >= 0 &&
+                          conn->out_sent >= conn->out.len &&
+                          conn->seg_i == conn->n_segs;
+        if (http_uring_poll(server, conn,
+                            source ? conn->stream.fd : conn->fd,
+                            source ? POLLIN : POLLOUT) < 0)
+          break;
+        return;
+      }
+      if (!http_conn_sent(server, conn))
+        break;
+    }
+
+    if (conn->state == HTTP_CONN_STREAMING) {
+      conn->in_len = 0;
+      if (conn->ev_cur && http_uring_send_event(server, conn) < 0)
+        break;
+      return;
+    }
+    if (!http_conn_handle(server, conn)) {
+      // the peer has stopped sending: the request stays incomplete
+      if (conn->ops_armed & 1u << HTTP_OP_RECV)
+        return;
+      break;
+    }
   }
+  http_conn_close(server, conn);
+}
 
-  free(req);
+static void http_uring_received(HttpServer *server, HttpConn *conn, int res,
+                                unsigned int flags, gint64 now) {
+  if (res > 0) {
+    unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    size_t n = MIN((size_t)res, sizeof(conn->in) - conn->in_len);
+    if (conn->fd >= 0 && conn->state != HTTP_CONN_STREAMING) {
+      memcpy(conn->in + conn->in_len, uring_buf(&server->bufs, bid), n);
+      conn->in_len += n;
+      // the rest is lost: answer what is there, then close
+      if (n < (size_t)res)
+        conn->keep_alive = 0;
+    }
+    uring_buf_ring_put(&server->bufs, bid);
+    if (conn->fd < 0)
+      return;
+    http_conn_touch(server, conn, now);
+    if (!(flags & IORING_CQE_F_MORE) && http_uring_recv(server, conn) < 0) {
+      http_conn_close(server, conn);
+      return;
+    }
+    http_uring_progress(server, conn);
+  } else if (conn->fd >= 0) {
+    // out of buffers: they come back as this batch is handled
+    if (res == -ENOBUFS) {
+      if (!(flags & IORING_CQE_F_MORE) && http_uring_recv(server, conn) < 0)
+        http_conn_close(server, conn);
+      return;
+    }
+    // the peer is done sending but may still wait for the answer, whose send
+    // can be queued and not submitted yet: the connection ends after it
+    if (res == 0 && conn->state == HTTP_CONN_WRITING) {
+      conn->subscribe = 0;
+      return;
+    }
+    http_conn_close(server, conn);
+  }
 }
 
-const char *http_request_query_get(HttpRequest *request, const char *key) {
-  HttpRequestQueryParam *curr = request->query;
-  while (curr) {
-    if (strcmp(curr->key, key) == 0) {
-      return curr->value;
+static void http_uring_sent(HttpServer *server, HttpConn *conn, int res) {
+  if (conn->fd < 0)
+    return;
+
+  if (conn->state == HTTP_CONN_STREAMING) {
+    if (res < 0) {
+      http_conn_close(server, conn);
+      return;
+    }
+    conn->ev_sent += res;
+    if (conn->ev_sent == conn->ev_cur->len) {
+      http_event_unref(conn->ev_cur);
+      conn->ev_cur = conn->ev_next;
+      conn->ev_next = NULL;
+      conn->ev_sent = 0;
+    }
+  } else {
+    if (res > 0)
+      http_conn_consume(conn, res);
+    // MSG_WAITALL: short only on error, which also cancels a linked close
+    if (res < 0 || conn->out_sent < conn->out.len ||
+        conn->seg_i < conn->n_segs) {
+      if (conn->ring_close_fd < 0)
+        http_conn_close(server, conn);
+      return;
+    }
+    frame_reset(&conn->out);
+    conn->out_sent = 0;
+    conn->n_segs = conn->seg_i = 0;
+    if (conn->ring_close_fd >= 0)
+      return;
+    if (!http_conn_sent(server, conn)) {
+      http_conn_close(server, conn);
+      return;
     }
-    curr = curr->next;
   }
-  return NULL;
+  http_uring_progress(server, conn);
 }
 
-void http_request_print(HttpRequest *request) {
-  printf("method: %s\n"
-         "path: %s\n",
-         // "query: %s\n",
-         http_method_to_string(request->method), request->path);
+/** One completion for a connection. */
+static void http_uring_complete(HttpServer *server, HttpConn *conn, int op,
+                                int res, unsigned int flags, gint64 now) {
+  gboolean last = !(flags & IORING_CQE_F_MORE);
+  if (last && op != HTTP_OP_CANCEL)
+    conn->ops_armed &= ~(1u << op);
+
+  switch (op) {
+  case HTTP_OP_RECV:
+    http_uring_received(server, conn, res, flags, now);
+    break;
+  case HTTP_OP_SEND:
+    http_uring_sent(server, conn, res);
+    break;
+  case HTTP_OP_POLL:
+    if (conn->fd < 0)
+      break;
+    if (res < 0)
+      http_conn_close(server, conn);
+    else
+      http_uring_progress(server, conn);
+    break;
+  case HTTP_OP_CLOSE: {
+    int fd = conn->ring_close_fd;
+    if (conn->fd >= 0)
+      http_conn_close(server, conn);
+    conn->ring_close_fd = -1;
+    // cancelled along with a failed send: the fd is still ours
+    if (res == -ECANCELED)
+      http_uring_close_fd(server, conn, fd);
+    break;
+  }
+  }
+
+  if (last && --conn->ops == 0 && conn->fd < 0) {
+    http_list_unlink(&server->closing, conn);
+    conn->next = server->spare;
+    server->spare = conn;
+  }
 }
 
-int http_server_run_until(unsigned short port,
-                          int (*callback)(HttpRequest *, HttpResponse *,
-                                          void *),
-                          void *user_data) {
-  int server = socket(AF_INET, SOCK_STREAM, 0);
-  if (server == -1) {
-    perror("socket");
-    return EXIT_FAILURE;
+/** The io_uring half of http_conn_close. */
+static void http_uring_close(HttpServer *server, HttpConn *conn) {
+  http_uring_cancel(server, conn, HTTP_OP_RECV);
+  http_uring_cancel(server, conn, HTTP_OP_SEND);
+  http_uring_cancel(server, conn, HTTP_OP_POLL);
+  if (conn->ring_close_fd < 0)
+    http_uring_close_fd(server, conn, conn->fd);
+  conn->fd = -1;
+
+  if (conn->ops) {
+    http_list_append(&server->closing, conn);
+  } else {
+    conn->next = server->spare;
+    server->spare = conn;
   }
+}
+#endif /* SNP_HAVE_IO_URING */
 
-  int enable = 1;
-  if (setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) <
-      0) {
-    perror("setsockopt(SO_REUSEADDR) failed");
-    goto socket_failure;
+/** Get `conn` going after something was queued on it from outside. */
+static void http_conn_kick(HttpServer *server, HttpConn *conn) {
+#ifdef SNP_HAVE_IO_URING
+  if (server->backend == HTTP_BACKEND_IO_URING) {
+    http_uring_progress(server, conn);
+    return;
+  }
+#endif
+  http_conn_drive(server, conn);
+}
+
+/** Close connections idle for too long. @returns ms until the next expiry */
+static int http_expire_idle(HttpServer *server, gint64 now) {
+  const gint64 timeout = (gint64)HTTP_IDLE_TIMEOUT_MS * 1000;
+  while (server->idle.head && now - server->idle.head->last_active >= timeout)
+    http_conn_close(server, server->idle.head);
+
+  if (!server->idle.head)
+    return -1;
+  return (server->idle.head->last_active + timeout - now + 999) / 1000;
+}
+
+/** Hand `msg` to every subscriber. */
+static void http_fan_out(HttpServer *server, HttpEventMsg *msg,
+                         gboolean only_quiet) {
+  for (HttpConn *conn = server->subscribers.head, *next; conn; conn = next) {
+    next = conn->next; // driving may close it
+    if (only_quiet && conn->ev_cur)
+      continue;
+    http_conn_push(conn, msg);
+    http_conn_kick(server, conn);
+  }
+}
+
+/** Send out the event http_server_broadcast left, if any. */
+static void http_dispatch(HttpServer *server) {
+  pthread_mutex_lock(&server->lock);
+  HttpEventMsg *msg = server->incoming;
+  server->incoming = NULL;
+  pthread_mutex_unlock(&server->lock);
+  if (!msg)
+    return;
+
+  http_event_unref(server->latest);
+  server->latest = msg;
+  http_fan_out(server, msg, FALSE);
+}
+
+/**
+ * Send a heartbeat to subscribers with nothing in flight, if one is due.
+ * @returns ms until the next one, or -1 if there is nobody to send it to
+ */
+static int http_heartbeat(HttpServer *server, gint64 now) {
+  const gint64 interval = (gint64)HTTP_HEARTBEAT_MS * 1000;
+  if (!server->subscribers.head) {
+    server->heartbeat_at = now + interval;
+    return -1;
+  }
+  if (now >= server->heartbeat_at) {
+    http_fan_out(server, server->heartbeat, TRUE);
+    server->heartbeat_at = now + interval;
   }
+  return (server->heartbeat_at - now + 999) / 1000;
+}
+
+static HttpEventMsg *http_event_new(size_t len) {
+  HttpEventMsg *msg = malloc(sizeof(HttpEventMsg) + len);
+  if (msg) {
+    msg->refs = 1;
+    msg->len = 0;
+  }
+  return msg;
+}
+
+static void http_event_append(HttpEventMsg *msg, const char *data,
+                              size_t len) {
+  memcpy(msg->data + msg->len, data, len);
+  msg->len += len;
+}
+
+/**
+ * Expire idle connections and send heartbeats that are due.
+ * @returns ms until either is due again, or -1
+ */
+static int http_housekeep(HttpServer *server, gint64 now) {
+  int timeout_ms = http_expire_idle(server, now);
+  int heartbeat_ms = http_heartbeat(server, now);
+  if (timeout_ms < 0 || (heartbeat_ms >= 0 && heartbeat_ms < timeout_ms))
+    timeout_ms = heartbeat_ms;
+  return timeout_ms;
+}
+
+#ifdef SNP_HAVE_IO_URING
+/** Accept every connection with one submission. */
+static void http_uring_accept(HttpServer *server) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = server->listener;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = http_op_data(server, HTTP_OP_ACCEPT);
+  server->accept_armed = 1;
+}
+
+/**
+ * Accept again after running out of fds, once a connection has closed or
+ * the backoff is over.
+ * @returns `timeout_ms`, shortened to when that is due
+ */
+static int http_uring_accept_resume(HttpServer *server, gint64 now,
+                                    int timeout_ms) {
+  if (server->accept_armed) {
+    // still accepting when another connection closed: there is room again
+    if (server->accept_retry)
+      server->accept_paused = server->accept_retry = 0;
+    return timeout_ms;
+  }
+  if (server->accept_retry || now >= server->accept_resume_at) {
+    server->accept_retry = 0;
+    http_uring_accept(server);
+    return timeout_ms;
+  }
+  int wait_ms = (server->accept_resume_at - now + 999) / 1000;
+  return timeout_ms < 0 || wait_ms < timeout_ms ? wait_ms : timeout_ms;
+}
+
+/** Watch the self-pipe for as long as the server runs. */
+static void http_uring_wake(HttpServer *server) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = server->wake[0];
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = http_op_data(server, HTTP_OP_WAKE);
+}
+
+static int http_uring_init(HttpServer *server) {
+  // completions are only processed when the server thread waits for them
+  if (uring_init(&server->ring, HTTP_URING_ENTRIES,
+                 IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN |
+                     IORING_SETUP_R_DISABLED) < 0)
+    return -1;
+  if (uring_buf_ring_init(&server->ring, &server->bufs, HTTP_URING_BUF_GROUP,
+                          HTTP_URING_BUFS, HTTP_URING_BUF_SIZE) < 0) {
+    int saved = errno;
+    uring_exit(&server->ring);
+    errno = saved;
+    return -1;
+  }
+  return 0;
+}
+
+static int http_uring_run(HttpServer *server) {
+  // the thread that enables the ring is the only one that may submit
+  if (!server->ring_enabled) {
+    if (uring_enable(&server->ring) < 0)
+      return -1;
+    server->ring_enabled = 1;
+    http_uring_accept(server);
+    http_uring_wake(server);
+  }
+
+  while (!atomic_load(&server->stop)) {
+    gint64 now = g_get_monotonic_time();
+    int timeout_ms = http_housekeep(server, now);
+    if (server->accept_paused)
+      timeout_ms = http_uring_accept_resume(server, now, timeout_ms);
+    if (uring_submit_and_wait(&server->ring, 1, timeout_ms) < 0 &&
+        errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+      return -1;
+
+    now = g_get_monotonic_time();
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&server->ring))) {
+      __u64 data = cqe->user_data;
+      int res = cqe->res;
+      unsigned int flags = cqe->flags;
+      uring_cqe_seen(&server->ring);
+
+      int op = data & HTTP_OP_MASK;
+      void *p = (void *)(uintptr_t)(data & ~(__u64)HTTP_OP_MASK);
+      if (op == HTTP_OP_ACCEPT) {
+        if (!(flags & IORING_CQE_F_MORE))
+          server->accept_armed = 0;
+        if (res >= 0) {
+          HttpConn *conn = http_conn_new(server, res, now);
+          if (conn && http_uring_recv(server, conn) < 0)
+            http_conn_close(server, conn);
+        } else if (res == -EMFILE || res == -ENFILE) {
+          // re-armed at once it would only fail again
+          if (!server->accept_paused)
+            fprintf(stderr, "accept: %s\n", strerror(-res));
+          server->accept_paused = 1;
+          server->accept_retry = 0;
+          server->accept_resume_at =
+              now + (gint64)HTTP_URING_ACCEPT_BACKOFF_MS * 1000;
+        } else if (res != -ECONNABORTED && res != -EINTR) {
+          fprintf(stderr, "accept: %s\n", strerror(-res));
+        }
+        if (!server->accept_armed && !server->accept_paused)
+          http_uring_accept(server);
+      } else if (op == HTTP_OP_WAKE) {
+        char drain[64];
+        while (read(server->wake[0], drain, sizeof(drain)) > 0)
+          ;
+        http_dispatch(server);
+        if (!(flags & IORING_CQE_F_MORE))
+          http_uring_wake(server);
+      } else {
+        http_uring_complete(server, p, op, res, flags, now);
+      }
+    }
+  }
+  return 0;
+}
+#endif /* SNP_HAVE_IO_URING */
+
+HttpServer *http_server_new(unsigned short port, HttpHandler handler,
+                            void *user_data) {
+  HttpBackend backend = HTTP_BACKEND_AUTO;
+  const char *name = getenv("SNP_HTTP_BACKEND");
+  if (name && (strcmp(name, "epoll") == 0 || strcmp(name, "kqueue") == 0))
+    backend = HTTP_BACKEND_POLL;
+  else if (name && strcmp(name, "io_uring") == 0)
+    backend = HTTP_BACKEND_IO_URING;
+  return http_server_new_with_backend(port, handler, user_data, backend);
+}
+
+/**
+ * Allow as many open files as the hard limit does: each connection is one,
+ * and the soft limit is often 1024.
+ */
+static void http_raise_fd_limit(void) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= limit.rlim_max)
+    return;
+  limit.rlim_cur = limit.rlim_max;
+#ifdef OPEN_MAX
+  // macOS refuses anything above OPEN_MAX, even with an unlimited hard limit
+  if (limit.rlim_cur > OPEN_MAX)
+    limit.rlim_cur = OPEN_MAX;
+#endif
+  setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+HttpServer *http_server_new_with_backend(unsigned short port,
+                                         HttpHandler handler, void *user_data,
+                                         HttpBackend backend) {
+  HttpServer *server = calloc(1, sizeof(HttpServer));
+  if (!server)
+    return NULL;
+  server->handler = handler;
+  server->user_data = user_data;
+  server->listener = -1;
+  server->wake[0] = server->wake[1] = -1;
+  server->queue = -1;
+  atomic_init(&server->stop, 0);
+  pthread_mutex_init(&server->lock, NULL);
+  http_raise_fd_limit();
+
+  server->heartbeat = http_event_new(sizeof(":\n\n") - 1);
+  if (!server->heartbeat)
+    goto failure;
+  http_event_append(server->heartbeat, ":\n\n", sizeof(":\n\n") - 1);
+
+  server->listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (server->listener == -1)
+    goto failure;
+
+  int enable = 1;
+  if (setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &enable,
+                 sizeof(enable)) < 0)
+    goto failure;
 
   struct sockaddr_in address = {.sin_family = AF_INET,
                                 .sin_addr = {.s_addr = htonl(INADDR_ANY)},
                                 .sin_port = htons(port)};
-  if (bind(server, (struct sockaddr *)&address, sizeof(address)) == -1) {
-    perror("bind");
-    goto socket_failure;
-  }
-
-  if (listen(server, 5) == -1) {
-    perror("listen");
-    goto socket_failure;
-  }
-
-  struct sockaddr_in client_address;
-  socklen_t client_len;
-  int client_socket;
-  int n_bytes;
-  char buf[BUFSIZ];
-  int should_exit = 0;
-
-  HttpResponse response = {0};
-  char serialized_response[BUFSIZ];
-
-  while (!should_exit) {
-    client_len = sizeof(struct sockaddr_in);
-    client_socket =
-        accept(server, (struct sockaddr *)&client_address, &client_len);
-    if (client_socket < 0) {
-      perror("accept");
-      goto socket_failure;
-    }
-
-    n_bytes = read(client_socket, buf, BUFSIZ - 1);
-    if (n_bytes > 0) {
-      buf[n_bytes] = 0; // terminate with null
-
-      // reset response data
-      strcpy(response.content_type, "text/html");
-      response.code = 404;
-      response.body[0] = 0;
-
-      // parse request
-      HttpRequest *request = http_request_parse_message(buf);
-      should_exit = callback(request, &response, user_data);
-      http_request_free(request);
-
-      sprintf(serialized_response,
-              "HTTP/1.1 %d\r\n"
-              "Content-Type: %s\r\n"
-              "\r\n"
-              "%s",
-              response.code, response.content_type, response.body);
-      write(client_socket, serialized_response,
-            strlen(serialized_response) + 1);
-    }
-    close(client_socket);
-  }
-  close(server);
-  return EXIT_SUCCESS;
-
-socket_failure:
-  close(server);
-  return EXIT_FAILURE;
+  socklen_t address_len = sizeof(address);
+  if (bind(server->listener, (struct sockaddr *)&address, address_len) == -1 ||
+      listen(server->listener, SOMAXCONN) == -1 ||
+      getsockname(server->listener, (struct sockaddr *)&address,
+                  &address_len) == -1)
+    goto failure;
+  server->port = ntohs(address.sin_port);
+  http_set_nonblocking(server->listener);
+
+  if (pipe(server->wake) == -1)
+    goto failure;
+  http_set_nonblocking(server->wake[0]);
+  http_set_nonblocking(server->wake[1]);
+
+#ifdef SNP_HAVE_IO_URING
+  if (backend != HTTP_BACKEND_POLL) {
+    if (http_uring_init(server) == 0) {
+      server->backend = HTTP_BACKEND_IO_URING;
+      return server;
+    }
+    if (backend == HTTP_BACKEND_IO_URING)
+      goto failure;
+  }
+#else
+  if (backend == HTTP_BACKEND_IO_URING) {
+    errno = ENOSYS;
+    goto failure;
+  }
+#endif
+  server->backend = HTTP_BACKEND_POLL;
+  server->queue = http_queue_new();
+  if (server->queue == -1 ||
+      http_queue_add(server->queue, server->listener, &server->listener) ==
+          -1 ||
+      http_queue_add(server->queue, server->wake[0], server->wake) == -1)
+    goto failure;
+  return server;
+
+failure: {
+  int saved = errno;
+  http_server_free(server);
+  errno = saved;
+  return NULL;
+}
+}
+
+unsigned short http_server_port(HttpServer *server) { return server->port; }
+
+const char *http_server_backend_name(const HttpServer *server) {
+  if (server->backend == HTTP_BACKEND_IO_URING)
+    return "io_uring";
+#ifdef __linux__
+  return "epoll";
+#else
+  return "kqueue";
+#endif
+}
+
+static int http_queue_run(HttpServer *server) {
+  HttpRawEvent raw[HTTP_EVENTS_MAX];
+  HttpEvent events[HTTP_EVENTS_MAX];
+
+  while (!atomic_load(&server->stop)) {
+    gint64 now = g_get_monotonic_time();
+    int timeout_ms = http_housekeep(server, now);
+    if (server->accept_retry)
+      http_accept(server, now);
+    int n = http_queue_wait(server->queue, raw, events, timeout_ms);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    now = g_get_monotonic_time();
+    for (int i = 0; i < n; i++) {
+      void *data = events[i];
+      if (data == &server->listener) {
+        http_accept(server, now);
+      } else if (data == server->wake) {
+        char drain[64];
+        while (read(server->wake[0], drain, sizeof(drain)) > 0)
+          ;
+        http_dispatch(server);
+      } else {
+        HttpConn *conn = data;
+        // kqueue reports reads and writes separately, and a connection closed
+        // by an earlier event in this batch may already be reused
+        if (conn->fd < 0)
+          continue;
+        if (http_conn_drive(server, conn))
+          http_conn_touch(server, conn, now);
+      }
+    }
+  }
+  return 0;
+}
+
+int http_server_run(HttpServer *server) {
+  // sendfile has no MSG_NOSIGNAL. Rather than ignore SIGPIPE for the whole
+  // process, keep it off this thread: a peer that went away is an EPIPE.
+  sigset_t pipe_set, old;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+
+  int ret;
+#ifdef SNP_HAVE_IO_URING
+  if (server->backend == HTTP_BACKEND_IO_URING)
+    ret = http_uring_run(server);
+  else
+#endif
+    ret = http_queue_run(server);
+
+  // one raised meanwhile is pending, and unblocking would deliver it
+  struct timespec zero = {0, 0};
+  while (sigtimedwait(&pipe_set, NULL, &zero) > 0)
+    ;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return ret;
+}
+
+static void http_server_wake(HttpServer *server) {
+  char byte = 0;
+  if (write(server->wake[1], &byte, 1) < 0) {
+    // a full pipe already has a wakeup pending
+  }
+}
+
+void http_server_stop(HttpServer *server) {
+  atomic_store(&server->stop, 1);
+  http_server_wake(server);
+}
+
+int http_server_broadcast(HttpServer *server, const char *event,
+                          const char *data, size_t len) {
+  // every line of `data` gets its own field
+  size_t lines = 1;
+  for (size_t i = 0; i < len; i++)
+    lines += data[i] == '\n';
+  size_t event_len = event ? strlen(event) : 0;
+
+  HttpEventMsg *msg = http_event_new(sizeof("event: \n") + event_len +
+                                     lines * sizeof("data: \n") + len + 1);
+  if (!msg)
+    return -1;
+  if (event) {
+    http_event_append(msg, "event: ", 7);
+    http_event_append(msg, event, event_len);
+    http_event_append(msg, "\n", 1);
+  }
+  for (const char *p = data, *end = data + len;;) {
+    const char *eol = memchr(p, '\n', end - p);
+    http_event_append(msg, "data: ", 6);
+    http_event_append(msg, p, (eol ? eol : end) - p);
+    http_event_append(msg, "\n", 1);
+    if (!eol)
+      break;
+    p = eol + 1;
+  }
+  http_event_append(msg, "\n", 1);
+
+  // only the newest is kept: events are states, not deltas
+  pthread_mutex_lock(&server->lock);
+  HttpEventMsg *old = server->incoming;
+  server->incoming = msg;
+  pthread_mutex_unlock(&server->lock);
+  http_event_unref(old);
+
+  http_server_wake(server);
+  return 0;
+}
+
+void http_server_free(HttpServer *server) {
+  if (!server)
+    return;
+
+  while (server->idle.head)
+    http_conn_close(server, server->idle.head);
+  while (server->subscribers.head)
+    http_conn_close(server, server->subscribers.head);
+#ifdef SNP_HAVE_IO_URING
+  if (server->backend == HTTP_BACKEND_IO_URING) {
+    // what is still in flight is cancelled with the ring
+    uring_buf_ring_free(&server->ring, &server->bufs);
+    uring_exit(&server->ring);
+    while (server->closing.head) {
+      HttpConn *conn = server->closing.head;
+      http_list_unlink(&server->closing, conn);
+      conn->next = server->spare;
+      server->spare = conn;
+    }
+  }
+#endif
+  while (server->spare) {
+    HttpConn *next = server->spare->next;
+    frame_free(&server->spare->out);
+    free(server->spare);
+    server->spare = next;
+  }
+
+  if (server->queue != -1)
+    close(server->queue);
+  if (server->wake[0] != -1)
+    close(server->wake[0]);
+  if (server->wake[1] != -1)
+    close(server->wake[1]);
+  if (server->listener != -1)
+    close(server->listener);
+  http_event_unref(server->incoming);
+  http_event_unref(server->latest);
+  http_event_unref(server->heartbeat);
+  pthread_mutex_destroy(&server->lock);
+  free(server);
+}
+
+int http_server_run_until(unsigned short port,
+                          int (*callback)(HttpRequest *, HttpResponse *,
+                                          void *),
+                          void *user_data) {
+  HttpServer *server = http_server_new(port, callback, user_data);
+  if (!server)
+    return -1;
+  int ret = http_server_run(server);
+  http_server_free(server);
+  return ret;
 }
@@ -1,14 +1,35 @@
 /*
 
-One-shot HTTP server to receive and parse OAuth codes (the final step of PKCE).
+Embedded HTTP/1.1 server: the OAuth callback (the final step of PKCE), and
+anything else that wants to serve a few small endpoints.
 
-Includes utilities to parse HTTP/1.1 URLs and query strings to perform some
-basic routing.
+Non-blocking sockets on an edge-triggered event queue (epoll on Linux, kqueue
+elsewhere), one state machine per connection: read until a request is
+complete, hand it to the callback, write the response, then either wait for
+the next request on the same connection (keep-alive) or close. Connections
+idle for longer than HTTP_IDLE_TIMEOUT_MS are closed.
 
-Limitations:
- - Single-threaded
- - Each connection is closed after the first request/response (no socket reuse).
+The callback can also turn a request into a Server-Sent Events subscription
+(text/event-stream); http_server_broadcast then pushes to every subscriber.
+
+On Linux 6.1 and later the same state machines can run on io_uring instead,
+which takes most system calls off the per-request path: one multishot accept
+for all connections, one multishot receive per connection into a shared ring
+of provided buffers, and responses sent with a single sendmsg submission,
+linked to the close when the connection does not stay open. File and
+streamed bodies still go through sendfile and read on readiness. The backend
+is picked when the server is created; SNP_HTTP_BACKEND=epoll in the
+environment forces the readiness one.
+
+Requests are parsed in place in the connection buffer, as they arrive, and
+without allocating; path, query parameters and headers are offsets into it,
+decoded only when looked up.
 
+Limitations:
+ - Single-threaded: the callback runs on the server's thread
+ - Requests, including any body, must fit in HTTP_CONN_BUFFER_SIZE; with
+   io_uring, so must pipelined requests waiting behind a response
+ - No chunked request bodies
 
 */
 
@@ -19,6 +40,7 @@ Limitations:
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
 typedef enum {
   HTTP_METHOD_GET = 0,
@@ -33,36 +55,287 @@ typedef enum {
   HTTP_METHOD_UNKNOWN
 } HttpMethod;
 
-typedef struct HttpRequestQueryParam HttpRequestQueryParam;
+/** Request bytes buffered per connection; larger requests get a 431/413. */
+#define HTTP_CONN_BUFFER_SIZE 8192
+/** Header lines kept per request; more get a 431. */
+#define HTTP_MAX_HEADERS 32
+/** Query parameters kept per request; more get a 414. */
+#define HTTP_MAX_QUERY_PARAMS 16
 
+/**
+ * A run of request bytes, as an offset into the buffer the request was
+ * parsed from. Nothing is copied or decoded until asked for.
+ */
 typedef struct {
+  unsigned short off;
+  unsigned short len;
+} HttpSpan;
+
+typedef struct {
+  HttpSpan name;
+  /** Without surrounding whitespace. */
+  HttpSpan value;
+} HttpHeader;
+
+typedef struct {
+  /** Still percent-encoded. */
+  HttpSpan key;
+  HttpSpan value;
+} HttpQueryParam;
+
+/**
+ * Request head, parsed in place: http_request_parse can be called again each
+ * time more bytes arrive, and picks up where it left off.
+ */
+typedef struct {
+  /** Buffer the spans point into, as last passed to http_request_parse. */
+  const char *buf;
+
   HttpMethod method;
-  char path[1024];
-  char __query[1024];
-  HttpRequestQueryParam *query;
+  /** Request target, and its path and query (without the '?') parts. */
+  HttpSpan target, path, query;
+  /** 0 for HTTP/1.0, 1 for HTTP/1.1. */
+  int minor_version;
+
+  HttpHeader headers[HTTP_MAX_HEADERS];
+  unsigned int n_headers;
+  HttpQueryParam params[HTTP_MAX_QUERY_PARAMS];
+  unsigned int n_params;
+  /** Open-addressed table of param indices by key hash; -1 is empty. */
+  signed char param_slots[HTTP_MAX_QUERY_PARAMS * 2];
+
+  /** Length of the head, including the blank line that ends it. */
+  size_t head_len;
+  size_t content_length;
+  /** Whether the connection stays open after the response. */
+  int keep_alive;
+  /** Status to answer with when parsing failed. */
+  unsigned short error;
+
+  /** Parser position: start of the next line, and how far it was scanned. */
+  size_t line_start, scanned;
+  int state;
 } HttpRequest;
 
+typedef enum {
+  /** The head is complete; the body is `content_length` bytes after it. */
+  HTTP_PARSE_DONE,
+  /** Call again with more bytes. */
+  HTTP_PARSE_INCOMPLETE,
+  /** Malformed or over a limit; answer with `error`. */
+  HTTP_PARSE_ERROR,
+} HttpParseStatus;
+
+/** Reset `request` for a new message. */
+void http_request_init(HttpRequest *request);
+
 /**
- * Assumption: request is a valid HTTP/1.1 request message
+ * Parse the request head at the start of `buf`, which holds the `len` bytes
+ * received so far (and the same bytes as last time, plus more). Never
+ * writes to `buf`, and never allocates.
  */
-HttpRequest *http_request_parse_message(char *request);
-void http_request_free(HttpRequest *req);
-const char *http_request_query_get(HttpRequest *request, const char *key);
-void http_request_print(HttpRequest *request);
+HttpParseStatus http_request_parse(HttpRequest *request, const char *buf,
+                                   size_t len);
+
+/** Whether the decoded path is exactly `path`. */
+int http_request_path_is(const HttpRequest *request, const char *path);
+
+/**
+ * Look up query parameter `key` (compared decoded) in constant time.
+ * @returns index into `params`, or -1
+ */
+int http_request_query_find(const HttpRequest *request, const char *key);
+
+/**
+ * Decode the value of query parameter `key` into `dest`, NUL-terminated and
+ * cut short to fit `n` bytes.
+ * @returns `dest`, or NULL if there is no such parameter
+ */
+const char *http_request_query_get(const HttpRequest *request, const char *key,
+                                   char *dest, size_t n);
+
+/**
+ * Value of header `name` (case-insensitive), not NUL-terminated.
+ * @returns NULL if absent
+ */
+const char *http_request_header_get(const HttpRequest *request,
+                                    const char *name, size_t *len);
+
+/**
+ * Percent-decode `span` of `buf` into `dest` (NUL-terminated, cut short to
+ * fit `n`); '+' becomes a space if `plus_is_space`.
+ * @returns the decoded length, before any cut
+ */
+size_t http_span_decode(const char *buf, HttpSpan span, int plus_is_space,
+                        char *dest, size_t n);
+
+void http_request_print(const HttpRequest *request);
+
+/** Extra header fields per response. */
+#define HTTP_MAX_RESPONSE_HEADERS 8
+/** Body segments per response. */
+#define HTTP_MAX_BODY_SEGMENTS 8
+/** Room for header values formatted with http_response_headerf. */
+#define HTTP_RESPONSE_SCRATCH_SIZE 256
+/** Length of a file segment that is read until EOF (sent chunked). */
+#define HTTP_LENGTH_TO_EOF ((size_t)-1)
 
+typedef struct {
+  /** Referenced, so both must outlive the handler (e.g. string literals). */
+  const char *name;
+  const char *value;
+} HttpField;
+
+/**
+ * A piece of the body, sent as it is: `len` bytes at `data`, or (if `fd` is
+ * not -1) `len` bytes of `fd` from `offset`. `release`, if set, is called
+ * with `release_data` once the bytes are no longer needed: after they were
+ * sent, or when the connection went away first.
+ */
+typedef struct {
+  const void *data;
+  int fd;
+  off_t offset;
+  size_t len;
+  void (*release)(void *release_data);
+  void *release_data;
+} HttpSegment;
+
+/**
+ * What a handler answers with. Header fields are serialized once the handler
+ * returns; body segments are referenced, not copied, and go out with
+ * writev(2), or sendfile(2) for file segments. A file segment of
+ * HTTP_LENGTH_TO_EOF length (e.g. a pipe) must come last and makes the body
+ * chunked.
+ */
 typedef struct {
   unsigned short code;
-  char content_type[64];
-  char body[512];
+  /** Referenced, like header fields; NULL to leave it out. */
+  const char *content_type;
+
+  HttpField headers[HTTP_MAX_RESPONSE_HEADERS];
+  unsigned int n_headers;
+  char scratch[HTTP_RESPONSE_SCRATCH_SIZE];
+  size_t scratch_len;
+  HttpSegment body[HTTP_MAX_BODY_SEGMENTS];
+  unsigned int n_body;
+
+  /**
+   * Answer a GET with a text/event-stream instead: the connection stays open
+   * and receives everything passed to http_server_broadcast, starting with
+   * the last event. Only honoured with code 200; the body is ignored.
+   */
+  int subscribe;
 } HttpResponse;
 
-typedef struct {
-  int socket;
-  struct sockaddr_in address;
-} HttpServer;
+/**
+ * Add a header field.
+ * @returns 0, or -1 if there are HTTP_MAX_RESPONSE_HEADERS already
+ */
+int http_response_header(HttpResponse *response, const char *name,
+                         const char *value);
+
+/**
+ * Add a header field whose value is formatted into the response itself, for
+ * values that would not outlive the handler.
+ * @returns 0, or -1 if there is no room for it
+ */
+int http_response_headerf(HttpResponse *response, const char *name,
+                          const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * Append `len` bytes at `data` to the body, by reference.
+ * @returns 0, or -1 if the body is full (`release` has been called then)
+ */
+int http_response_body(HttpResponse *response, const void *data, size_t len,
+                       void (*release)(void *), void *release_data);
+
+/**
+ * Append `len` bytes of `fd` from `offset`, or everything up to EOF with
+ * HTTP_LENGTH_TO_EOF. `fd` is not closed unless `release` does it.
+ * @returns 0, or -1 if the body is full (`release` has been called then)
+ */
+int http_response_body_fd(HttpResponse *response, int fd, off_t offset,
+                          size_t len, void (*release)(void *),
+                          void *release_data);
+
+/**
+ * Append formatted text to the body.
+ * @returns 0, or -1 if the body is full
+ */
+int http_response_printf(HttpResponse *response, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/** Connections open at once; more are accepted and closed straight away. */
+#define HTTP_MAX_CONNECTIONS 16384
+/** Keep-alive connections with nothing to do are closed after this long. */
+#define HTTP_IDLE_TIMEOUT_MS 30000
+/**
+ * Event stream subscribers that have not been sent anything for this long
+ * get a comment line, so dead peers (and idle proxies) are noticed.
+ */
+#define HTTP_HEARTBEAT_MS 15000
+
+/**
+ * Fills in `response` for `request`. `response` starts out as a 404 with an
+ * empty text/html body. `request` is only valid until it returns.
+ * @returns non-zero to stop the server once this response has been sent
+ */
+typedef int (*HttpHandler)(HttpRequest *request, HttpResponse *response,
+                           void *user_data);
+
+typedef struct HttpServer HttpServer;
+
+typedef enum {
+  /** io_uring if built in and the kernel has what it needs, else polling. */
+  HTTP_BACKEND_AUTO,
+  /** Readiness events: epoll on Linux, kqueue elsewhere. */
+  HTTP_BACKEND_POLL,
+  HTTP_BACKEND_IO_URING,
+} HttpBackend;
+
+/**
+ * Listen on `port` on all interfaces; 0 picks a free port (see
+ * http_server_port). The backend is chosen as for HTTP_BACKEND_AUTO, unless
+ * $SNP_HTTP_BACKEND says `epoll` or `io_uring`.
+ * @returns NULL on error (errno is set)
+ */
+HttpServer *http_server_new(unsigned short port, HttpHandler handler,
+                            void *user_data);
+/**
+ * http_server_new with a given backend. Like any server, it must be run
+ * from one thread, which need not be the one that created it.
+ * @returns NULL on error (errno is set; ENOSYS if `backend` is not built in)
+ */
+HttpServer *http_server_new_with_backend(unsigned short port,
+                                         HttpHandler handler, void *user_data,
+                                         HttpBackend backend);
+void http_server_free(HttpServer *server);
+unsigned short http_server_port(HttpServer *server);
+/** "epoll", "kqueue" or "io_uring". */
+const char *http_server_backend_name(const HttpServer *server);
+
+/**
+ * Serve until the handler asks to stop or http_server_stop is called.
+ * @returns 0, or -1 if waiting for events failed (errno is set)
+ */
+int http_server_run(HttpServer *server);
+/** Make http_server_run return soon. Safe to call from any thread. */
+void http_server_stop(HttpServer *server);
+
+/**
+ * Send an event (`event` may be NULL for an unnamed one) to every subscriber.
+ * It is serialized here, once, and the same bytes are written to each
+ * connection as far as that connection will take them; the others never
+ * wait on a slow one. Events are treated as states rather than deltas: one
+ * superseded before a subscriber got to it is skipped. Safe to call from
+ * any thread.
+ * @returns 0, or -1 if out of memory
+ */
+int http_server_broadcast(HttpServer *server, const char *event,
+                          const char *data, size_t len);
 
-// void http_server_init(HttpServer *server, unsigned short port);
-// void http_server_destroy(HttpServer *server);
 /**
  * Run server until `callback` returns non-zero.
  */
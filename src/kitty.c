@@ -0,0 +1,140 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "kitty.h"
+
+#define KITTY_APC_START "\033_G"
+#define KITTY_APC_END "\033\\"
+/** Max payload per escape sequence; must be a multiple of 4. */
+#define KITTY_CHUNK 4096
+
+guint32 kitty_image_id(const char *url) {
+  // FNV-1a
+  guint32 h = 2166136261u;
+  for (const char *c = url ? url : ""; *c; c++) {
+    h ^= (guint8)*c;
+    h *= 16777619u;
+  }
+  return h ? h : 1;
+}
+
+static const char b64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/** Base64-encode `n` bytes into `dest`, which needs room for 4 * ceil(n/3). */
+static char *b64_encode(char *dest, const guint8 *src, size_t n) {
+  size_t i = 0;
+  for (; i + 3 <= n; i += 3) {
+    guint32 v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+    *dest++ = b64_alphabet[(v >> 18) & 63];
+    *dest++ = b64_alphabet[(v >> 12) & 63];
+    *dest++ = b64_alphabet[(v >> 6) & 63];
+    *dest++ = b64_alphabet[v & 63];
+  }
+  if (i < n) {
+    guint32 v = src[i] << 16;
+    if (i + 1 < n)
+      v |= src[i + 1] << 8;
+    *dest++ = b64_alphabet[(v >> 18) & 63];
+    *dest++ = b64_alphabet[(v >> 12) & 63];
+    *dest++ = i + 1 < n ? b64_alphabet[(v >> 6) & 63] : '=';
+    *dest++ = '=';
+  }
+  return dest;
+}
+
+void kitty_upload_rgb(FrameBuffer *out, guint32 id, const guint8 *pixels,
+                      int width, int height) {
+  size_t size = (size_t)width * height * 3;
+  // each chunk carries KITTY_CHUNK base64 chars, i.e. 3/4 as many raw bytes
+  const size_t raw_chunk = KITTY_CHUNK / 4 * 3;
+
+  size_t off = 0;
+  int more;
+  do {
+    size_t n = MIN(raw_chunk, size - off);
+    more = off + n < size;
+
+    char *p = frame_reserve(out, KITTY_SEQ_LENGTH_MAX + KITTY_CHUNK);
+    if (off == 0)
+      p += sprintf(p, KITTY_APC_START "a=t,f=24,s=%d,v=%d,i=%u,q=2,m=%d;",
+                   width, height, id, more);
+    else
+      p += sprintf(p, KITTY_APC_START "m=%d;", more);
+    p = b64_encode(p, pixels + off, n);
+    memcpy(p, KITTY_APC_END, sizeof(KITTY_APC_END) - 1);
+    frame_commit(out, p + sizeof(KITTY_APC_END) - 1);
+    off += n;
+  } while (more);
+}
+
+gboolean kitty_is_local(void) {
+  return !g_getenv("SSH_CONNECTION") && !g_getenv("SSH_CLIENT") &&
+         !g_getenv("SSH_TTY");
+}
+
+/** Shared memory object name for `id`; short enough for macOS' 31 chars. */
+static void kitty_shm_name(char *dest, size_t n, guint32 id) {
+  snprintf(dest, n, "/snp-%d-%08x", (int)getpid(), id);
+}
+
+int kitty_upload_rgb_shm(FrameBuffer *out, guint32 id, const guint8 *pixels,
+                         int width, int height) {
+  size_t size = (size_t)width * height * 3;
+  char name[32];
+  kitty_shm_name(name, sizeof(name), id);
+
+  shm_unlink(name); // left over from an upload the terminal never read
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd == -1) {
+    perror("shm_open");
+    return -1;
+  }
+  if (ftruncate(fd, size) == -1) {
+    perror("ftruncate");
+    goto fail;
+  }
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    goto fail;
+  }
+  memcpy(mem, pixels, size);
+  munmap(mem, size);
+  close(fd);
+
+  char *p = frame_reserve(out, KITTY_SEQ_LENGTH_MAX + sizeof(name) * 2);
+  p += sprintf(p,
+               KITTY_APC_START "a=t,f=24,s=%d,v=%d,i=%u,t=s,S=%zu,q=2;", width,
+               height, id, size);
+  p = b64_encode(p, (const guint8 *)name, strlen(name));
+  memcpy(p, KITTY_APC_END, sizeof(KITTY_APC_END) - 1);
+  frame_commit(out, p + sizeof(KITTY_APC_END) - 1);
+  return 0;
+
+fail:
+  close(fd);
+  shm_unlink(name);
+  return -1;
+}
+
+void kitty_shm_release(guint32 id) {
+  char name[32];
+  kitty_shm_name(name, sizeof(name), id);
+  shm_unlink(name);
+}
+
+char *kitty_emit_place(char *dest, guint32 id, int cols, int rows) {
+  return dest + sprintf(dest,
+                        KITTY_APC_START
+                        "a=p,i=%u,p=1,c=%d,r=%d,C=1,q=2" KITTY_APC_END,
+                        id, cols, rows);
+}
+
+char *kitty_emit_delete(char *dest, guint32 id) {
+  return dest +
+         sprintf(dest, KITTY_APC_START "a=d,d=I,i=%u,q=2" KITTY_APC_END, id);
+}
@@ -0,0 +1,60 @@
+/*
+
+Kitty graphics protocol, used directly instead of through chafa so that a cover
+is transmitted once and then only referenced by id.
+
+https://sw.kovidgoyal.net/kitty/graphics-protocol/
+
+*/
+
+#ifndef __SNP_KITTY_H__
+#define __SNP_KITTY_H__
+
+#include <glib.h>
+
+#include "frame.h"
+
+/** Upper bound on the length of a sequence from a kitty_emit_* function. */
+#define KITTY_SEQ_LENGTH_MAX 96
+
+/** Stable, non-zero image id for the image at `url`. */
+guint32 kitty_image_id(const char *url);
+
+/**
+ * Transmit (but do not display) packed RGB pixels under `id`, replacing any
+ * image previously stored under it.
+ */
+void kitty_upload_rgb(FrameBuffer *out, guint32 id, const guint8 *pixels,
+                      int width, int height);
+
+/**
+ * Whether the terminal runs on this machine, and so can read pixels we put
+ * in shared memory. Sessions over ssh are assumed remote.
+ */
+gboolean kitty_is_local(void);
+
+/**
+ * Like kitty_upload_rgb, but hand the pixels over in a POSIX shared memory
+ * object rather than inline as base64. The terminal unlinks the object once it
+ * has read it. Only use this when kitty_is_local.
+ * @returns 0 on success, -1 if the object could not be created
+ */
+int kitty_upload_rgb_shm(FrameBuffer *out, guint32 id, const guint8 *pixels,
+                         int width, int height);
+
+/**
+ * Unlink the shared memory object for `id` in case the terminal never read
+ * it. Harmless if it already did.
+ */
+void kitty_shm_release(guint32 id);
+
+/**
+ * Display image `id` at the cursor, scaled to `cols` x `rows` cells, without
+ * moving the cursor. Re-placing the same id moves the existing placement.
+ */
+char *kitty_emit_place(char *dest, guint32 id, int cols, int rows);
+
+/** Delete image `id` along with its placements and stored pixel data. */
+char *kitty_emit_delete(char *dest, guint32 id);
+
+#endif /* __SNP_KITTY_H__ */
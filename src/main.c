@@ -4,15 +4,23 @@
 #include <unistd.h>
 
 #include <chafa.h>
+#include <getopt.h>
 #include <jansson.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include "constants.h"
+#include "daemon.h"
+#include "poller.h"
+#include "render-bench.h"
 #include "spotify.h"
+#include "status-server.h"
 #include "term-util.h"
+#include "ui.h"
 
 #define PIX_WIDTH 3
 #define PIX_HEIGHT 3
@@ -77,122 +85,200 @@ void print_test_pattern(void) {
   chafa_symbol_map_unref(symbol_map);
 }
 
-struct ui_ctx {
-  ChafaTermInfo *term_info;
-  ChafaPixelMode pixel_mode;
-  ChafaCanvasMode canvas_mode;
-  ChafaSymbolMap *symbol_map;
-};
-
-void ui_setup(struct ui_ctx *ctx) {
-  detect_terminal_mode(&ctx->term_info, &ctx->canvas_mode, &ctx->pixel_mode);
-  ctx->symbol_map = chafa_symbol_map_new();
-  chafa_symbol_map_add_by_tags(ctx->symbol_map, CHAFA_SYMBOL_TAG_ASCII);
-
-  char buf[CHAFA_TERM_SEQ_LENGTH_MAX * 2];
-  char *p = buf;
-  p = chafa_term_info_emit_clear(ctx->term_info, p);
-  p = chafa_term_info_emit_cursor_to_top_left(ctx->term_info, p);
-  fwrite(buf, 1, p - buf, stdout);
+static void publish_status(const SpotifyCurrentlyPlaying *playing,
+                           void *status) {
+  status_server_publish(status, playing);
 }
 
-void ui_teardown(struct ui_ctx *ctx) {
-  chafa_term_info_unref(ctx->term_info);
-  chafa_symbol_map_unref(ctx->symbol_map);
+static void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -a, --attach   show the frames of a running --daemon\n"
+          "  -b, --max-rate N\n"
+          "                 output budget in bytes/s; covers degrade to fit\n"
+          "  -d, --daemon   poll and render for --attach clients on a socket\n"
+          "  -f, --fps N    frame rate of the UI, %d-%d (default %d)\n"
+          "  -p, --http-port N\n"
+          "                 serve now-playing events on port N (/events)\n"
+          "  -r, --renderer chafa|halfblock\n"
+          "                 how covers are drawn with text (default chafa)\n"
+          "  -S, --socket PATH\n"
+          "                 daemon socket (default in $XDG_RUNTIME_DIR)\n"
+          "  -s, --stats    print per-frame output stats to stderr\n"
+          "  -t, --threads N\n"
+          "                 threads chafa renders with (default: all cores)\n"
+          "  --measure-threads\n"
+          "                 time each mode at 1..N render threads and exit\n"
+          "  -h, --help     show this help\n",
+          argv0, SNP_UI_MIN_FPS, SNP_UI_MAX_FPS, SNP_UI_DEFAULT_FPS);
 }
 
-void ui_render(struct ui_ctx *ctx, SpotifyCurrentlyPlaying *playing) {
-  static char last_rendered[64] = "";
-
-  char buf[CHAFA_TERM_SEQ_LENGTH_MAX * 3];
-  char *p;
-
-  p = buf;
-  p = chafa_term_info_emit_clear(ctx->term_info, p);
-  fwrite(buf, 1, p - buf, stdout);
-
-  p = buf;
-  p = chafa_term_info_emit_cursor_to_pos(ctx->term_info, p, 17, 1);
-  fwrite(buf, 1, p - buf, stdout);
-  printf(term_c_bold("%s") "\n", playing->track_name);
-
-  p = buf;
-  p = chafa_term_info_emit_cursor_to_pos(ctx->term_info, p, 17, 2);
-  fwrite(buf, 1, p - buf, stdout);
-  printf(term_c_dim("%s") "\n", playing->album_name);
-
-  p = buf;
-  p = chafa_term_info_emit_cursor_to_pos(ctx->term_info, p, 17, 5);
-  fwrite(buf, 1, p - buf, stdout);
-  printf("%s\n", playing->artists[0]);
-
-  p = buf;
-  p = chafa_term_info_emit_cursor_to_top_left(ctx->term_info, p);
-  fwrite(buf, 1, p - buf, stdout);
-
-  ChafaCanvasConfig *config;
-  ChafaCanvas *canvas;
-
-  struct term_dimensions dim = get_term_dimensions();
-
-  int width_cells = 14;
-  int height_cells = 7;
-  chafa_calc_canvas_geometry(playing->album_cover->width,
-                             playing->album_cover->height, &width_cells,
-                             &height_cells, dim.font_ratio, FALSE, FALSE);
-
-  config = chafa_canvas_config_new();
-  chafa_canvas_config_set_symbol_map(config, ctx->symbol_map);
-  chafa_canvas_config_set_canvas_mode(config, ctx->canvas_mode);
-  chafa_canvas_config_set_pixel_mode(config, ctx->pixel_mode);
-  chafa_canvas_config_set_geometry(config, width_cells, height_cells);
-  if (dim.ch_px > 0 && dim.cw_px > 0)
-    chafa_canvas_config_set_cell_geometry(config, dim.cw_px, dim.ch_px);
-
-  canvas = chafa_canvas_new(config);
-  chafa_canvas_draw_all_pixels(
-      canvas, CHAFA_PIXEL_RGB8, playing->album_cover->pixels,
-      playing->album_cover->width, playing->album_cover->height,
-      playing->album_cover->width * 3);
-
-  GString *gs = chafa_canvas_print(canvas, ctx->term_info);
-  fwrite(gs->str, sizeof(char), gs->len, stdout);
-  fputc('\n', stdout);
-  g_string_free(gs, TRUE);
+int main(int argc, char **argv) {
+  int show_stats = 0;
+  int fps = SNP_UI_DEFAULT_FPS;
+  int threads = 0;
+  int measure_threads = 0;
+  UiRenderer renderer = UI_RENDERER_CHAFA;
+  long max_rate = 0;
+  int daemon = 0, attach = 0;
+  int http_port = 0;
+  char socket_path[108];
+  daemon_socket_path_default(socket_path, sizeof(socket_path));
+
+  const struct option long_options[] = {
+      {"attach", no_argument, NULL, 'a'},
+      {"max-rate", required_argument, NULL, 'b'},
+      {"daemon", no_argument, NULL, 'd'},
+      {"fps", required_argument, NULL, 'f'},
+      {"http-port", required_argument, NULL, 'p'},
+      {"renderer", required_argument, NULL, 'r'},
+      {"socket", required_argument, NULL, 'S'},
+      {"stats", no_argument, NULL, 's'},
+      {"threads", required_argument, NULL, 't'},
+      {"measure-threads", no_argument, &measure_threads, 1},
+      {"help", no_argument, NULL, 'h'},
+      {0, 0, 0, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "ab:df:p:r:S:st:h", long_options,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'a':
+      attach = 1;
+      break;
+    case 'b':
+      max_rate = atol(optarg);
+      break;
+    case 'd':
+      daemon = 1;
+      break;
+    case 'f':
+      fps = CLAMP(atoi(optarg), SNP_UI_MIN_FPS, SNP_UI_MAX_FPS);
+      break;
+    case 'p':
+      http_port = atoi(optarg);
+      if (http_port <= 0 || http_port > 65535) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'r':
+      if (strcmp(optarg, "halfblock") == 0) {
+        renderer = UI_RENDERER_HALFBLOCK;
+      } else if (strcmp(optarg, "chafa") == 0) {
+        renderer = UI_RENDERER_CHAFA;
+      } else {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'S':
+      snprintf(socket_path, sizeof(socket_path), "%s", optarg);
+      break;
+    case 's':
+      show_stats = 1;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 0: // flag set by getopt itself
+      break;
+    case 'h':
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
 
-  chafa_canvas_unref(canvas);
-  chafa_canvas_config_unref(config);
-}
+  if (measure_threads) {
+    render_bench_threads(threads > 0 ? threads : (int)g_get_num_processors());
+    return EXIT_SUCCESS;
+  }
+  if (attach) {
+    // everything but the terminal itself is the daemon's job
+    if (daemon_attach(socket_path) != 0) {
+      perror(socket_path);
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+  // on shared hosts, --threads 1 keeps rendering to a single core
+  chafa_set_n_threads(threads > 0 ? threads : -1);
 
-int main(void) {
   struct ui_ctx ctx = {0};
-  ui_setup(&ctx);
+  if (!daemon) {
+    ui_setup(&ctx);
+    ctx.renderer = renderer;
+    ctx.max_rate = max_rate;
+  }
 
   SpotifyAuth *auth = spotify_auth_new_from_oauth();
   if (!auth)
     return EXIT_FAILURE;
 
-  u_char it = 0;
-  SpotifyCurrentlyPlaying *playing = NULL;
-  while (1) {
-    if (it == 0) {
-      // term_rel_cursor(0, 0);
-      // printf(term_c_dim(".\n.\n.\n"));
-      spotify_currently_playing_free(playing);
-      playing = spotify_currently_playing_get(auth);
-      // term_rel_clear();
-      // term_print_image(
-      //     playing->album_cover->pixels, playing->album_cover->width,
-      //     playing->album_cover->height, playing->album_cover->width * 3, 12,
-      //     6);
-      // break;
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  SnapshotSlot slot;
+  snapshot_slot_init(&slot, poller_snapshot_free);
+  Poller poller = {0};
+  StatusServer *status = NULL;
+  if (http_port) {
+    status = status_server_start(http_port);
+    if (!status) {
+      perror("status server");
+      return EXIT_FAILURE;
     }
-    it = (it + 1) % 4;
+    poller.observer = publish_status;
+    poller.observer_data = status;
+  }
+  if (poller_start(&poller, auth, &slot, SNP_POLL_INTERVAL_MS) != 0)
+    return EXIT_FAILURE;
 
-    ui_render(&ctx, playing);
+  if (daemon) {
+    DaemonOptions options = {
+        .fps = fps, .renderer = renderer, .show_stats = show_stats};
+    daemon_run(socket_path, &slot, &options);
+    perror(socket_path);
+    poller_stop(&poller);
+    if (status)
+      status_server_stop(status);
+    snapshot_slot_destroy(&slot);
+    spotify_auth_free(auth);
+    return EXIT_FAILURE;
+  }
+
+  int resize_fd = term_resize_watch();
 
-    sleep(1);
+  // frames are paced off a monotonic deadline, independent of the poller
+  gint64 next_frame = g_get_monotonic_time();
+  while (1) {
+    SpotifyCurrentlyPlaying *playing = snapshot_acquire(&slot);
+    int closed = ui_render(&ctx, playing) != 0;
+    snapshot_release(&slot);
+    if (closed)
+      break;
+    poller_set_cover_size(&poller, ctx.cover_want_w, ctx.cover_want_h);
+    if (show_stats)
+      ui_stats_print(&ctx, stderr);
+
+    gint64 now = g_get_monotonic_time();
+    next_frame += G_USEC_PER_SEC / fps;
+    if (next_frame < now)
+      next_frame = now; // fell behind; skip frames rather than burst
+
+    // sleep until the next frame, but re-layout straight away on resize
+    if (term_resize_wait(resize_fd, (next_frame - now) / 1000)) {
+      ui_resize(&ctx);
+      next_frame = g_get_monotonic_time();
+    }
   }
+  poller_stop(&poller);
+  if (status)
+    status_server_stop(status);
+  snapshot_slot_destroy(&slot);
+  spotify_auth_free(auth);
   ui_teardown(&ctx);
   return 0;
 }
@@ -0,0 +1,296 @@
+#include <curl/curl.h>
+#include <glib.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "poll-engine.h"
+
+struct PollSession {
+  const SpotifyAuth *auth;
+  void *user_data;
+  CURL *curl;
+  /** Of the poll in flight, if any. */
+  struct curl_slist *headers;
+  ResponseBuffer *response;
+  gboolean in_flight;
+  /** When the next (or current) poll is due, monotonic µs. */
+  gint64 due;
+};
+
+struct PollEngine {
+  PollEngineOptions options;
+  CURLM *multi;
+  atomic_int stop;
+
+  PollSession **sessions;
+  unsigned int n_sessions, sessions_cap;
+  /** Sessions waiting for their next poll, earliest due first. */
+  PollSession **heap;
+  unsigned int heap_len;
+  unsigned int in_flight;
+
+  unsigned long polls, failures;
+  /** Lags of the latest polls, µs; a ring once full. */
+  gint64 lags[POLL_ENGINE_LAG_SAMPLES];
+  unsigned long n_lags;
+};
+
+static void poll_heap_push(PollEngine *engine, PollSession *session) {
+  // holds every session at most once, so it never outgrows `sessions`
+  unsigned int i = engine->heap_len++;
+  while (i > 0) {
+    unsigned int parent = (i - 1) / 2;
+    if (engine->heap[parent]->due <= session->due)
+      break;
+    engine->heap[i] = engine->heap[parent];
+    i = parent;
+  }
+  engine->heap[i] = session;
+}
+
+static PollSession *poll_heap_pop(PollEngine *engine) {
+  PollSession *top = engine->heap[0];
+  PollSession *last = engine->heap[--engine->heap_len];
+  unsigned int i = 0;
+  for (;;) {
+    unsigned int child = 2 * i + 1;
+    if (child >= engine->heap_len)
+      break;
+    if (child + 1 < engine->heap_len &&
+        engine->heap[child + 1]->due < engine->heap[child]->due)
+      child++;
+    if (last->due <= engine->heap[child]->due)
+      break;
+    engine->heap[i] = engine->heap[child];
+    i = child;
+  }
+  if (engine->heap_len)
+    engine->heap[i] = last;
+  return top;
+}
+
+PollEngine *poll_engine_new(const PollEngineOptions *options) {
+  PollEngine *engine = calloc(1, sizeof(PollEngine));
+  if (!engine)
+    return NULL;
+  engine->options = *options;
+  if (!engine->options.endpoint)
+    engine->options.endpoint = SNP_SPOTIFY_API_CURRENTLY_PLAYING;
+  if (!engine->options.interval_ms)
+    engine->options.interval_ms = SNP_POLL_INTERVAL_MS;
+  if (!engine->options.max_in_flight)
+    engine->options.max_in_flight = POLL_ENGINE_MAX_IN_FLIGHT;
+  atomic_init(&engine->stop, 0);
+
+  engine->multi = curl_multi_init();
+  if (!engine->multi) {
+    free(engine);
+    return NULL;
+  }
+  // every account polls the same host: share a few HTTP/2 connections
+  curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  return engine;
+}
+
+void poll_engine_free(PollEngine *engine) {
+  if (!engine)
+    return;
+  for (unsigned int i = 0; i < engine->n_sessions; i++) {
+    PollSession *session = engine->sessions[i];
+    if (session->in_flight)
+      curl_multi_remove_handle(engine->multi, session->curl);
+    curl_easy_cleanup(session->curl);
+    curl_slist_free_all(session->headers);
+    response_buffer_free(session->response);
+    free(session);
+  }
+  curl_multi_cleanup(engine->multi);
+  free(engine->sessions);
+  free(engine->heap);
+  free(engine);
+}
+
+PollSession *poll_engine_add(PollEngine *engine, const SpotifyAuth *auth,
+                             void *user_data) {
+  if (engine->n_sessions == engine->sessions_cap) {
+    unsigned int cap = engine->sessions_cap ? engine->sessions_cap * 2 : 64;
+    PollSession **sessions =
+        realloc(engine->sessions, cap * sizeof(PollSession *));
+    if (!sessions)
+      return NULL;
+    engine->sessions = sessions;
+    PollSession **heap = realloc(engine->heap, cap * sizeof(PollSession *));
+    if (!heap)
+      return NULL;
+    engine->heap = heap;
+    engine->sessions_cap = cap;
+  }
+
+  PollSession *session = calloc(1, sizeof(PollSession));
+  if (!session)
+    return NULL;
+  session->auth = auth;
+  session->user_data = user_data;
+  session->curl = curl_easy_init();
+  session->response = response_buffer_new();
+  if (!session->curl || !session->response) {
+    curl_easy_cleanup(session->curl);
+    response_buffer_free(session->response);
+    free(session);
+    return NULL;
+  }
+
+  // golden-ratio steps spread any number of sessions evenly over the interval
+  guint64 step = (guint64)engine->n_sessions * 0x9E3779B97F4A7C15ull;
+  guint64 interval = (guint64)engine->options.interval_ms * 1000;
+  session->due =
+      g_get_monotonic_time() + (gint64)(((step >> 32) * interval) >> 32);
+
+  engine->sessions[engine->n_sessions++] = session;
+  poll_heap_push(engine, session);
+  return session;
+}
+
+void *poll_session_data(const PollSession *session) {
+  return session->user_data;
+}
+
+static int poll_session_start(PollEngine *engine, PollSession *session,
+                              gint64 now) {
+  engine->lags[engine->n_lags++ % POLL_ENGINE_LAG_SAMPLES] = now - session->due;
+
+  session->response->size = 0;
+  curl_slist_free_all(session->headers);
+  session->headers =
+      spotify_api_prepare(session->curl, engine->options.endpoint,
+                          session->auth, session->response);
+  curl_easy_setopt(session->curl, CURLOPT_PRIVATE, session);
+  curl_easy_setopt(session->curl, CURLOPT_TIMEOUT_MS,
+                   (long)POLL_ENGINE_TIMEOUT_MS);
+  curl_easy_setopt(session->curl, CURLOPT_NOSIGNAL, 1L);
+  // rather wait for a connection to multiplex on than open another
+  curl_easy_setopt(session->curl, CURLOPT_PIPEWAIT, 1L);
+  if (curl_multi_add_handle(engine->multi, session->curl) != CURLM_OK)
+    return -1;
+  session->in_flight = TRUE;
+  engine->in_flight++;
+  return 0;
+}
+
+/** Hand on what a finished poll got, and schedule the next one. */
+static void poll_session_done(PollEngine *engine, PollSession *session,
+                              CURLcode result, gint64 now) {
+  curl_multi_remove_handle(engine->multi, session->curl);
+  session->in_flight = FALSE;
+  engine->in_flight--;
+  engine->polls++;
+
+  // a fixed rate, but one that catches up at once rather than in a burst
+  gint64 next = session->due + (gint64)engine->options.interval_ms * 1000;
+  if (next < now)
+    next = now;
+
+  long code = 0;
+  curl_easy_getinfo(session->curl, CURLINFO_RESPONSE_CODE, &code);
+  if (result != CURLE_OK || code > 299) {
+    engine->failures++;
+    curl_off_t retry_after = 0;
+    if (code == 429 &&
+        curl_easy_getinfo(session->curl, CURLINFO_RETRY_AFTER, &retry_after) ==
+            CURLE_OK &&
+        now + retry_after * G_USEC_PER_SEC > next)
+      next = now + retry_after * G_USEC_PER_SEC;
+  } else {
+    json_t *root = NULL;
+    json_error_t error;
+    if (session->response->size &&
+        !(root = json_loads(session->response->contents, 0, &error))) {
+      engine->failures++;
+    } else {
+      // an empty 204 means nothing is playing
+      SpotifyCurrentlyPlaying *playing =
+          spotify_currently_playing_from_json(root);
+      if (engine->options.callback)
+        engine->options.callback(session, playing, engine->options.data);
+      else
+        spotify_currently_playing_free(playing);
+    }
+  }
+
+  session->due = next;
+  poll_heap_push(engine, session);
+}
+
+int poll_engine_run(PollEngine *engine) {
+  const gint64 interval = (gint64)engine->options.interval_ms * 1000;
+  while (!atomic_load(&engine->stop)) {
+    gint64 now = g_get_monotonic_time();
+    while (engine->heap_len && engine->heap[0]->due <= now &&
+           engine->in_flight < engine->options.max_in_flight) {
+      PollSession *session = poll_heap_pop(engine);
+      if (poll_session_start(engine, session, now) < 0) {
+        engine->failures++;
+        session->due = now + interval;
+        poll_heap_push(engine, session);
+      }
+    }
+
+    int running;
+    if (curl_multi_perform(engine->multi, &running) != CURLM_OK)
+      return -1;
+    now = g_get_monotonic_time();
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(engine->multi, &left))) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      CURLcode result = msg->data.result;
+      PollSession *session;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &session);
+      poll_session_done(engine, session, result, now);
+    }
+
+    // until the next poll is due, if there is room to start it
+    int timeout_ms = 1000;
+    if (engine->heap_len && engine->in_flight < engine->options.max_in_flight) {
+      gint64 wait = engine->heap[0]->due - g_get_monotonic_time();
+      timeout_ms = wait <= 0 ? 0 : (int)MIN((wait + 999) / 1000, 1000);
+    }
+    if (curl_multi_poll(engine->multi, NULL, 0, timeout_ms, NULL) != CURLM_OK)
+      return -1;
+  }
+  return 0;
+}
+
+void poll_engine_stop(PollEngine *engine) {
+  atomic_store(&engine->stop, 1);
+  curl_multi_wakeup(engine->multi);
+}
+
+static int poll_compare_lag(const void *a, const void *b) {
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+void poll_engine_stats(PollEngine *engine, PollEngineStats *stats) {
+  memset(stats, 0, sizeof(PollEngineStats));
+  stats->sessions = engine->n_sessions;
+  stats->in_flight = engine->in_flight;
+  stats->polls = engine->polls;
+  stats->failures = engine->failures;
+
+  size_t n = MIN(engine->n_lags, POLL_ENGINE_LAG_SAMPLES);
+  if (!n)
+    return;
+  gint64 *sorted = malloc(n * sizeof(gint64));
+  if (!sorted)
+    return;
+  memcpy(sorted, engine->lags, n * sizeof(gint64));
+  qsort(sorted, n, sizeof(gint64), poll_compare_lag);
+  stats->lag_p50_ms = sorted[(n - 1) / 2] / 1000.0;
+  stats->lag_p99_ms = sorted[(size_t)((n - 1) * 0.99)] / 1000.0;
+  stats->lag_max_ms = sorted[n - 1] / 1000.0;
+  free(sorted);
+}
@@ -0,0 +1,96 @@
+/*
+
+Polls currently-playing for many accounts from one thread.
+
+Each session is one authenticated account. Sessions wait in a min-heap keyed
+by when their next poll is due; the engine starts every poll that is due as
+a transfer on one curl multi handle, and sleeps in curl_multi_poll until the
+next one is due or a transfer needs attention. There is no thread per
+account, and a session costs a heap slot and an easy handle whose
+connections are shared with the rest.
+
+Polls run at a fixed rate per session, staggered over the interval so a
+thousand sessions added at once do not all go out together. When the
+engine falls behind, polls are late, not skipped or bunched up; how late is
+the poll lag, reported as percentiles over recent polls. A session answered
+with 429 waits for as long as Retry-After says.
+
+Covers are not fetched: results come with album_cover NULL and cover_url
+set, for the caller to fetch what it needs.
+
+*/
+
+#ifndef __SNP_POLL_ENGINE_H__
+#define __SNP_POLL_ENGINE_H__
+
+#include "spotify.h"
+
+/** Polls in flight at once, unless configured otherwise. */
+#define POLL_ENGINE_MAX_IN_FLIGHT 256
+/** A poll taking longer than this fails. */
+#define POLL_ENGINE_TIMEOUT_MS 10000
+/** Most recent polls the lag percentiles are over. */
+#define POLL_ENGINE_LAG_SAMPLES 8192
+
+typedef struct PollEngine PollEngine;
+typedef struct PollSession PollSession;
+
+/**
+ * Called on the engine's thread with each successful poll's result, which
+ * it takes ownership of.
+ */
+typedef void (*PollEngineCallback)(PollSession *session,
+                                   SpotifyCurrentlyPlaying *playing,
+                                   void *data);
+
+typedef struct {
+  /** Polled URL; default SNP_SPOTIFY_API_CURRENTLY_PLAYING. */
+  const char *endpoint;
+  /** Between polls of a session; default SNP_POLL_INTERVAL_MS. */
+  unsigned int interval_ms;
+  /** Default POLL_ENGINE_MAX_IN_FLIGHT. */
+  unsigned int max_in_flight;
+  PollEngineCallback callback;
+  void *data;
+} PollEngineOptions;
+
+typedef struct {
+  unsigned int sessions;
+  unsigned int in_flight;
+  unsigned long polls;
+  unsigned long failures;
+  /** How long after it was due each recent poll started. */
+  double lag_p50_ms, lag_p99_ms, lag_max_ms;
+} PollEngineStats;
+
+/** @returns NULL on error */
+PollEngine *poll_engine_new(const PollEngineOptions *options);
+
+/** Free the engine, its sessions and what they have in flight. */
+void poll_engine_free(PollEngine *engine);
+
+/**
+ * Poll as `auth` from now on; the first poll is some way into the first
+ * interval. `auth` must outlive the engine. Call before poll_engine_run or
+ * from the callback.
+ * @returns NULL on error
+ */
+PollSession *poll_engine_add(PollEngine *engine, const SpotifyAuth *auth,
+                             void *user_data);
+
+/** The user_data `session` was added with. */
+void *poll_session_data(const PollSession *session);
+
+/**
+ * Poll until poll_engine_stop.
+ * @returns 0 once stopped, -1 on error
+ */
+int poll_engine_run(PollEngine *engine);
+
+/** Make poll_engine_run return soon; from any thread. */
+void poll_engine_stop(PollEngine *engine);
+
+/** From the engine's thread, or once it has stopped. */
+void poll_engine_stats(PollEngine *engine, PollEngineStats *stats);
+
+#endif /* __SNP_POLL_ENGINE_H__ */
@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "constants.h"
+#include "poller.h"
+#include "scale.h"
+
+static long long poller_now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/**
+ * Shrink `cover` to the size asked for, unless it already is. Only for a
+ * cover nobody else holds yet.
+ */
+static void poller_cover_prescale(Poller *poller, SpotifyAlbumCover *cover) {
+  unsigned int size = atomic_load(&poller->cover_size);
+  int w = size >> 16, h = size & 0xffff;
+  if (w == cover->scaled_width && h == cover->scaled_height)
+    return;
+  free(cover->scaled);
+  cover->scaled = NULL;
+  cover->scaled_width = cover->scaled_height = 0;
+  if (w <= 0 || h <= 0 || w > cover->width || h > cover->height)
+    return;
+
+  unsigned char *scaled = malloc((size_t)w * h * 3);
+  if (!scaled || scale_rgb_box(cover->pixels, cover->width, cover->height,
+                               cover->width * 3, scaled, w, h) != 0) {
+    free(scaled);
+    return;
+  }
+  cover->scaled = scaled;
+  cover->scaled_width = w;
+  cover->scaled_height = h;
+}
+
+/** The cached cover for `url`, or NULL. */
+static SpotifyAlbumCover *poller_cover_lookup(Poller *poller, const char *url) {
+  for (int i = 0; i < POLLER_COVER_CACHE_SIZE; i++) {
+    SpotifyAlbumCover *cover = poller->covers[i];
+    if (cover && strcmp(cover->url, url) == 0) {
+      poller->covers_used[i] = ++poller->covers_clock;
+      return cover;
+    }
+  }
+  return NULL;
+}
+
+/** Download `url` into the cache, evicting the least recently used. */
+static SpotifyAlbumCover *poller_cover_fetch(Poller *poller, const char *url) {
+  SpotifyAlbumCover *cover = spotify_album_cover_fetch(url);
+  if (!cover)
+    return NULL;
+  poller_cover_prescale(poller, cover);
+
+  int victim = 0;
+  for (int i = 0; i < POLLER_COVER_CACHE_SIZE; i++) {
+    if (!poller->covers[i]) {
+      victim = i;
+      break;
+    }
+    if (poller->covers_used[i] < poller->covers_used[victim])
+      victim = i;
+  }
+  // snapshots still showing it hold their own references
+  spotify_album_cover_free(poller->covers[victim]);
+  poller->covers[victim] = cover;
+  poller->covers_used[victim] = ++poller->covers_clock;
+  return cover;
+}
+
+/** A reference to the cover at `url`, downloaded only if not cached. */
+static SpotifyAlbumCover *poller_cover_get(Poller *poller, const char *url) {
+  SpotifyAlbumCover *cover = poller_cover_lookup(poller, url);
+  if (cover) {
+    // fetched ahead of time but not shown yet: the UI may have resized since
+    if (atomic_load(&cover->refs) == 1)
+      poller_cover_prescale(poller, cover);
+  } else {
+    cover = poller_cover_fetch(poller, url);
+  }
+  return spotify_album_cover_ref(cover);
+}
+
+/**
+ * Read the queue and fetch the covers of what plays next. Only an
+ * optimisation, so a failed or rate-limited read is skipped.
+ */
+static void poller_prefetch(Poller *poller) {
+  json_t *queue = spotify_api_try_get(SNP_SPOTIFY_API_QUEUE, poller->auth);
+  const char *urls[SNP_PREFETCH_COVERS];
+  size_t n = spotify_queue_cover_urls(queue, urls, SNP_PREFETCH_COVERS);
+  for (size_t i = 0; i < n; i++)
+    if (!poller_cover_lookup(poller, urls[i]))
+      poller_cover_fetch(poller, urls[i]);
+  json_decref(queue);
+}
+
+/**
+ * Hand `playing` to the UI, and if it is `final` to the observer too: the
+ * status server has no use for stages it would only cache and push again.
+ * It must not change after.
+ */
+static void poller_publish(Poller *poller, SpotifyCurrentlyPlaying *playing,
+                           int final) {
+  if (final && poller->observer)
+    poller->observer(playing, poller->observer_data);
+  snapshot_publish(poller->slot, playing);
+}
+
+/**
+ * Publish `playing` with its cover. A cover that was not fetched ahead of
+ * time goes out in stages: the text at once, then the smallest image, which
+ * is a fraction of the size, then the cover itself in its place. Previews
+ * are cached like covers, so a cover that cannot be had leaves the preview
+ * up rather than flipping back to the text alone on every poll.
+ */
+static void poller_publish_staged(Poller *poller,
+                                  SpotifyCurrentlyPlaying *playing) {
+  const char *url = playing->cover_url;
+  if (url && !poller_cover_lookup(poller, url)) {
+    const char *preview_url = playing->cover_preview_url;
+    if (preview_url && strcmp(preview_url, url) == 0)
+      preview_url = NULL;
+    SpotifyAlbumCover *preview =
+        preview_url ? poller_cover_lookup(poller, preview_url) : NULL;
+    SpotifyCurrentlyPlaying *next;
+    if (!preview) {
+      next = spotify_currently_playing_copy(playing);
+      poller_publish(poller, playing, 0);
+      playing = next;
+      if (preview_url)
+        preview = poller_cover_fetch(poller, preview_url);
+    }
+    if (preview) {
+      playing->album_cover = spotify_album_cover_ref(preview);
+      next = spotify_currently_playing_copy(playing);
+      poller_publish(poller, playing, 0);
+      playing = next;
+    }
+  }
+  if (url) {
+    SpotifyAlbumCover *cover = poller_cover_get(poller, url);
+    if (cover) {
+      spotify_album_cover_free(playing->album_cover);
+      playing->album_cover = cover;
+    }
+  }
+  poller_publish(poller, playing, 1);
+}
+
+static void *poller_main(void *arg) {
+  Poller *poller = arg;
+
+  pthread_mutex_lock(&poller->lock);
+  while (!poller->stop) {
+    pthread_mutex_unlock(&poller->lock);
+
+    // the next poll is due an interval after this one started, however long
+    // prefetching takes in between
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += poller->interval_ms / 1000;
+    deadline.tv_nsec += (poller->interval_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+    SpotifyCurrentlyPlaying *playing = spotify_currently_playing_from_json(
+        spotify_api_get(SNP_SPOTIFY_API_CURRENTLY_PLAYING, poller->auth));
+    char track[sizeof(poller->queue_track)];
+    snprintf(track, sizeof(track), "%s", playing->id ? playing->id : "");
+    poller_publish_staged(poller, playing);
+
+    long long now = poller_now_ms();
+    if (track[0] && (strcmp(track, poller->queue_track) != 0 ||
+                     now - poller->queue_read_at >= SNP_QUEUE_INTERVAL_MS)) {
+      poller_prefetch(poller);
+      snprintf(poller->queue_track, sizeof(poller->queue_track), "%s", track);
+      poller->queue_read_at = now;
+    }
+    pthread_mutex_lock(&poller->lock);
+
+    while (!poller->stop &&
+           pthread_cond_timedwait(&poller->wake, &poller->lock, &deadline) !=
+               ETIMEDOUT)
+      ;
+  }
+  pthread_mutex_unlock(&poller->lock);
+  return NULL;
+}
+
+int poller_start(Poller *poller, SpotifyAuth *auth, SnapshotSlot *slot,
+                 unsigned int interval_ms) {
+  poller->auth = auth;
+  poller->slot = slot;
+  poller->interval_ms = interval_ms;
+  poller->stop = 0;
+  atomic_init(&poller->cover_size, 0);
+  memset(poller->covers, 0, sizeof(poller->covers));
+  poller->covers_clock = 0;
+  poller->queue_track[0] = 0;
+  poller->queue_read_at = 0;
+  pthread_mutex_init(&poller->lock, NULL);
+  pthread_cond_init(&poller->wake, NULL);
+
+  int err = pthread_create(&poller->thread, NULL, poller_main, poller);
+  if (err) {
+    fprintf(stderr, "unable to start poller thread: %d\n", err);
+    return -1;
+  }
+  return 0;
+}
+
+void poller_stop(Poller *poller) {
+  pthread_mutex_lock(&poller->lock);
+  poller->stop = 1;
+  pthread_cond_signal(&poller->wake);
+  pthread_mutex_unlock(&poller->lock);
+
+  pthread_join(poller->thread, NULL);
+  pthread_cond_destroy(&poller->wake);
+  pthread_mutex_destroy(&poller->lock);
+  for (int i = 0; i < POLLER_COVER_CACHE_SIZE; i++)
+    spotify_album_cover_free(poller->covers[i]);
+}
+
+void poller_set_cover_size(Poller *poller, int width, int height) {
+  unsigned int size = width > 0 && height > 0 && width <= 0xffff &&
+                              height <= 0xffff
+                          ? (unsigned int)width << 16 | (unsigned int)height
+                          : 0;
+  atomic_store(&poller->cover_size, size);
+}
+
+void poller_snapshot_free(void *snapshot) {
+  spotify_currently_playing_free(snapshot);
+}
@@ -0,0 +1,81 @@
+/*
+
+Background thread that polls the currently playing track and publishes each
+result into a SnapshotSlot, so that the UI never waits on the network.
+
+Covers are kept decoded across polls, so one is only downloaded when the
+album changes. The queue is read every so often, and on every track change,
+and the covers of the next few tracks are downloaded, decoded and shrunk to
+the size the UI last drew at ahead of time: when the track changes, its
+cover is ready with the poll that notices.
+
+A cover that was not fetched ahead of time is published in stages, each a
+snapshot of its own: the text as soon as the response is read, then with the
+album's smallest image, then with the cover itself. Should the cover fail
+to download, the smallest image stays.
+
+*/
+
+#ifndef __SNP_POLLER_H__
+#define __SNP_POLLER_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "snapshot.h"
+#include "spotify.h"
+
+/** Decoded covers kept: the current one, upcoming ones and a few past. */
+#define POLLER_COVER_CACHE_SIZE 8
+
+typedef struct {
+  SpotifyAuth *auth;
+  SnapshotSlot *slot;
+  unsigned int interval_ms;
+
+  /**
+   * Optional; called on the poller thread with every result, just before
+   * it is published, but not with the earlier stages of a staged one. Set
+   * these before poller_start.
+   */
+  void (*observer)(const SpotifyCurrentlyPlaying *playing, void *data);
+  void *observer_data;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int stop;
+
+  /** Size covers are shrunk to in advance, width << 16 | height; 0: none. */
+  atomic_uint cover_size;
+
+  /** Poller thread only. Least recently used evicted first. */
+  SpotifyAlbumCover *covers[POLLER_COVER_CACHE_SIZE];
+  unsigned long covers_used[POLLER_COVER_CACHE_SIZE];
+  unsigned long covers_clock;
+  /** Track the queue was last read during, and when, CLOCK_MONOTONIC ms. */
+  char queue_track[64];
+  long long queue_read_at;
+} Poller;
+
+/**
+ * Start polling every `interval_ms` into `slot`, which receives
+ * SpotifyCurrentlyPlaying snapshots.
+ * @returns 0 on success
+ */
+int poller_start(Poller *poller, SpotifyAuth *auth, SnapshotSlot *slot,
+                 unsigned int interval_ms);
+
+/** Stop the thread, waiting for an in-flight request to finish. */
+void poller_stop(Poller *poller);
+
+/**
+ * Have covers shrunk to `width` x `height` pixels ahead of time from now on,
+ * e.g. what the UI last drew at; 0 for neither. From any thread.
+ */
+void poller_set_cover_size(Poller *poller, int width, int height);
+
+/** Free function for the slot the poller publishes into. */
+void poller_snapshot_free(void *snapshot);
+
+#endif /* __SNP_POLLER_H__ */
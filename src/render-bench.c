@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc-stats.h"
+#include "frame.h"
+#include "halfblock.h"
+#include "kitty.h"
+#include "render-bench.h"
+#include "scale.h"
+
+#define BENCH_COVER_SIZE 640
+#define BENCH_WIDTH_CELLS 64
+#define BENCH_HEIGHT_CELLS 32
+#define BENCH_CELL_WIDTH 10
+#define BENCH_CELL_HEIGHT 20
+#define BENCH_MIN_MS 300
+
+const RenderBenchMode render_bench_modes[] = {
+    {"symbols-truecolor", CHAFA_CANVAS_MODE_TRUECOLOR,
+     CHAFA_PIXEL_MODE_SYMBOLS, FALSE},
+    {"symbols-240", CHAFA_CANVAS_MODE_INDEXED_240, CHAFA_PIXEL_MODE_SYMBOLS,
+     FALSE},
+    {"symbols-16", CHAFA_CANVAS_MODE_INDEXED_16, CHAFA_PIXEL_MODE_SYMBOLS,
+     FALSE},
+    {"symbols-fgbg", CHAFA_CANVAS_MODE_FGBG, CHAFA_PIXEL_MODE_SYMBOLS, FALSE},
+    {"sixels", CHAFA_CANVAS_MODE_TRUECOLOR, CHAFA_PIXEL_MODE_SIXELS, FALSE},
+    {"kitty", CHAFA_CANVAS_MODE_TRUECOLOR, CHAFA_PIXEL_MODE_KITTY, FALSE},
+    {"iterm2", CHAFA_CANVAS_MODE_TRUECOLOR, CHAFA_PIXEL_MODE_ITERM2, FALSE},
+    {"halfblock-truecolor", CHAFA_CANVAS_MODE_TRUECOLOR,
+     CHAFA_PIXEL_MODE_SYMBOLS, TRUE},
+    {"halfblock-240", CHAFA_CANVAS_MODE_INDEXED_240, CHAFA_PIXEL_MODE_SYMBOLS,
+     TRUE},
+    {NULL, 0, 0, FALSE},
+};
+
+SpotifyAlbumCover *render_bench_cover_new(int width, int height) {
+  SpotifyAlbumCover *cover = malloc(sizeof(*cover));
+  cover->width = width;
+  cover->height = height;
+  cover->url = NULL;
+  cover->jpeg = NULL;
+  cover->jpeg_size = 0;
+  cover->scaled = NULL;
+  cover->scaled_width = cover->scaled_height = 0;
+  atomic_init(&cover->refs, 1);
+  cover->pixels = malloc((size_t)width * height * 3);
+
+  // gradients plus a fine checker, so neither quantization nor symbol
+  // matching gets to take shortcuts on flat areas
+  unsigned char *p = cover->pixels;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int checker = ((x / 5) ^ (y / 5)) & 1;
+      *p++ = x * 255 / width;
+      *p++ = y * 255 / height;
+      *p++ = checker ? 220 : (x + y) * 127 / (width + height);
+    }
+  }
+  return cover;
+}
+
+void render_bench_cover_free(SpotifyAlbumCover *cover) {
+  free(cover->pixels);
+  free(cover);
+}
+
+/** Pixel size the UI downscales to before handing a cover to chafa. */
+static void render_bench_scaled_size(const RenderBenchMode *mode,
+                                     int width_cells, int height_cells,
+                                     int cell_width, int cell_height, int *w,
+                                     int *h) {
+  if (mode->halfblock) {
+    *w = width_cells;
+    *h = height_cells * 2;
+  } else if (mode->pixel_mode == CHAFA_PIXEL_MODE_SYMBOLS) {
+    *w = width_cells * 8;
+    *h = height_cells * 8;
+  } else {
+    *w = width_cells * cell_width;
+    *h = height_cells * cell_height;
+  }
+}
+
+/** One frame; returns the number of bytes it would send to the terminal. */
+static size_t render_bench_frame(ChafaTermInfo *term_info,
+                                 const RenderBenchMode *mode,
+                                 const SpotifyAlbumCover *cover,
+                                 ChafaCanvas *canvas, guint8 *scaled, int w,
+                                 int h, FrameBuffer *frame) {
+  if (mode->pixel_mode == CHAFA_PIXEL_MODE_KITTY) {
+    frame_reset(frame);
+    kitty_upload_rgb(frame, 1, cover->pixels, cover->width, cover->height);
+    return frame->len;
+  }
+
+  const guint8 *pixels = cover->pixels;
+  if (scaled && scale_rgb_box(cover->pixels, cover->width, cover->height,
+                              cover->width * 3, scaled, w, h) == 0) {
+    pixels = scaled;
+  } else {
+    w = cover->width;
+    h = cover->height;
+  }
+
+  if (mode->halfblock && pixels == scaled) {
+    frame_reset(frame);
+    halfblock_render(frame, pixels, w, h, w * 3,
+                     mode->canvas_mode == CHAFA_CANVAS_MODE_TRUECOLOR
+                         ? HALFBLOCK_TRUECOLOR
+                         : HALFBLOCK_240);
+    return frame->len;
+  }
+
+  chafa_canvas_draw_all_pixels(canvas, CHAFA_PIXEL_RGB8, pixels, w, h, w * 3);
+  GString *gs = chafa_canvas_print(canvas, term_info);
+  size_t len = gs->len;
+  g_string_free(gs, TRUE);
+  return len;
+}
+
+void render_bench_run(ChafaTermInfo *term_info, const RenderBenchMode *mode,
+                      const SpotifyAlbumCover *cover, int width_cells,
+                      int height_cells, int cell_width, int cell_height,
+                      int min_ms, RenderBenchResult *out) {
+  ChafaSymbolMap *symbol_map = chafa_symbol_map_new();
+  chafa_symbol_map_add_by_tags(symbol_map, CHAFA_SYMBOL_TAG_ASCII);
+
+  ChafaCanvasConfig *config = chafa_canvas_config_new();
+  chafa_canvas_config_set_symbol_map(config, symbol_map);
+  chafa_canvas_config_set_canvas_mode(config, mode->canvas_mode);
+  chafa_canvas_config_set_pixel_mode(config, mode->pixel_mode);
+  chafa_canvas_config_set_geometry(config, width_cells, height_cells);
+  chafa_canvas_config_set_cell_geometry(config, cell_width, cell_height);
+  ChafaCanvas *canvas = chafa_canvas_new(config);
+
+  int w, h;
+  render_bench_scaled_size(mode, width_cells, height_cells, cell_width,
+                           cell_height, &w, &h);
+  guint8 *scaled = w <= cover->width && h <= cover->height
+                       ? malloc((size_t)w * h * 3)
+                       : NULL;
+
+  FrameBuffer frame;
+  frame_init(&frame);
+
+  size_t bytes = 0;
+  int frames = 0;
+  unsigned long allocs = alloc_stats_count();
+  gint64 start = g_get_monotonic_time(), elapsed;
+  do {
+    bytes += render_bench_frame(term_info, mode, cover, canvas, scaled, w, h,
+                                &frame);
+    frames++;
+    elapsed = g_get_monotonic_time() - start;
+  } while (elapsed < min_ms * 1000 || frames < 3);
+  allocs = alloc_stats_count() - allocs;
+
+  out->frames = frames;
+  out->ms_per_frame = elapsed / 1000.0 / frames;
+  out->bytes_per_frame = bytes / frames;
+  out->allocs_per_frame = (double)allocs / frames;
+
+  frame_free(&frame);
+  free(scaled);
+  chafa_canvas_unref(canvas);
+  chafa_canvas_config_unref(config);
+  chafa_symbol_map_unref(symbol_map);
+}
+
+void render_bench_threads(int max_threads) {
+  // the fallback info knows every sequence, so each pixel mode can print
+  ChafaTermInfo *term_info =
+      chafa_term_db_get_fallback_info(chafa_term_db_get_default());
+  SpotifyAlbumCover *cover =
+      render_bench_cover_new(BENCH_COVER_SIZE, BENCH_COVER_SIZE);
+
+  printf("%dx%d cover on a %dx%d cell canvas (%dx%d px cells)\n\n",
+         BENCH_COVER_SIZE, BENCH_COVER_SIZE, BENCH_WIDTH_CELLS,
+         BENCH_HEIGHT_CELLS, BENCH_CELL_WIDTH, BENCH_CELL_HEIGHT);
+  printf("%-18s %7s %9s %7s\n", "mode", "threads", "ms/frame", "speedup");
+
+  for (const RenderBenchMode *mode = render_bench_modes; mode->name; mode++) {
+    double single = 0;
+    for (int n = 1; n <= max_threads; n++) {
+      chafa_set_n_threads(n);
+      RenderBenchResult r;
+      render_bench_run(term_info, mode, cover, BENCH_WIDTH_CELLS,
+                       BENCH_HEIGHT_CELLS, BENCH_CELL_WIDTH, BENCH_CELL_HEIGHT,
+                       BENCH_MIN_MS, &r);
+      if (n == 1)
+        single = r.ms_per_frame;
+      printf("%-18s %7d %9.2f %6.2fx\n", mode->name, n, r.ms_per_frame,
+             single / r.ms_per_frame);
+      fflush(stdout);
+    }
+  }
+
+  chafa_set_n_threads(-1);
+  render_bench_cover_free(cover);
+  chafa_term_info_unref(term_info);
+}
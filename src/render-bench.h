@@ -0,0 +1,57 @@
+/*
+
+Offline measurements of the cover rendering path, independent of Spotify and
+of the terminal actually attached.
+
+*/
+
+#ifndef __SNP_RENDER_BENCH_H__
+#define __SNP_RENDER_BENCH_H__
+
+#include <chafa.h>
+
+#include "spotify.h"
+
+/** A canvas/pixel mode combination worth measuring. */
+typedef struct {
+  const char *name;
+  ChafaCanvasMode canvas_mode;
+  ChafaPixelMode pixel_mode;
+  /** Drawn by halfblock_render instead of chafa (symbol modes only). */
+  gboolean halfblock;
+} RenderBenchMode;
+
+/**
+ * Every mode detect_terminal_mode can pick, plus the half-block renderer's;
+ * terminated by a NULL name.
+ */
+extern const RenderBenchMode render_bench_modes[];
+
+/** Deterministic, detailed stand-in for a cover. */
+SpotifyAlbumCover *render_bench_cover_new(int width, int height);
+void render_bench_cover_free(SpotifyAlbumCover *cover);
+
+typedef struct {
+  int frames;
+  double ms_per_frame;
+  size_t bytes_per_frame;
+  /** Only meaningful when alloc_stats_enabled(). */
+  double allocs_per_frame;
+} RenderBenchResult;
+
+/**
+ * Repeatedly render `cover` the way the UI does on a cache miss (downscale,
+ * then chafa; or the kitty upload) for at least `min_ms`, and average.
+ */
+void render_bench_run(ChafaTermInfo *term_info, const RenderBenchMode *mode,
+                      const SpotifyAlbumCover *cover, int width_cells,
+                      int height_cells, int cell_width, int cell_height,
+                      int min_ms, RenderBenchResult *out);
+
+/**
+ * Render a fixed cover in every mode with 1..max_threads chafa threads and
+ * print ms/frame for each to stdout.
+ */
+void render_bench_threads(int max_threads);
+
+#endif /* __SNP_RENDER_BENCH_H__ */
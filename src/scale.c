@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scale.h"
+
+/** Weights are 16.16 fixed point; the taps of one output sum to exactly 1. */
+#define SCALE_SHIFT 16
+#define SCALE_ONE (1u << SCALE_SHIFT)
+#define SCALE_HALF (1u << (SCALE_SHIFT - 1))
+
+typedef uint8_t v4u8 __attribute__((vector_size(4)));
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+
+/** Source taps and their weights for each output index along one axis. */
+typedef struct {
+  int *first;
+  int *count;
+  guint32 *weights; // `taps` slots per output
+  int taps;
+} ScaleFilter;
+
+static void scale_filter_free(ScaleFilter *f) {
+  free(f->first);
+  free(f->count);
+  free(f->weights);
+}
+
+static int scale_filter_init(ScaleFilter *f, int src, int dst) {
+  // an output spans src/dst source pixels, plus a partial one at either end
+  f->taps = src / dst + 2;
+  f->first = malloc(dst * sizeof(*f->first));
+  f->count = malloc(dst * sizeof(*f->count));
+  f->weights = calloc((size_t)dst * f->taps, sizeof(*f->weights));
+  if (!f->first || !f->count || !f->weights)
+    return -1; // caller frees
+
+  for (int o = 0; o < dst; o++) {
+    // measured in 1/dst of a source pixel, so all the bounds are integers
+    long lo = (long)o * src, hi = (long)(o + 1) * src;
+    int s0 = lo / dst, s1 = (hi - 1) / dst;
+    guint32 *w = &f->weights[(size_t)o * f->taps];
+    guint32 sum = 0;
+
+    f->first[o] = s0;
+    f->count[o] = s1 - s0 + 1;
+    for (int s = s0; s <= s1; s++) {
+      long a = MAX(lo, (long)s * dst), b = MIN(hi, (long)(s + 1) * dst);
+      w[s - s0] = (guint32)((b - a) * SCALE_ONE / src);
+      sum += w[s - s0];
+    }
+    // rounding leftovers go to the last tap, so flat areas stay exact
+    w[s1 - s0] += SCALE_ONE - sum;
+  }
+  return 0;
+}
+
+/** Average `src_h` rows of `len` bytes down to `dst_h` rows. */
+static void scale_vertical(const guint8 *src, int src_stride, size_t len,
+                           const ScaleFilter *f, int dst_h, guint8 *dst,
+                           v4u32 *acc) {
+  size_t n_vec = len / 4;
+
+  for (int oy = 0; oy < dst_h; oy++) {
+    guint32 tail[3] = {0, 0, 0};
+    memset(acc, 0, n_vec * sizeof(*acc));
+
+    for (int k = 0; k < f->count[oy]; k++) {
+      const guint8 *row = src + (size_t)(f->first[oy] + k) * src_stride;
+      guint32 w = f->weights[(size_t)oy * f->taps + k];
+
+      for (size_t v = 0; v < n_vec; v++) {
+        v4u8 px;
+        memcpy(&px, row + v * 4, sizeof(px));
+        acc[v] += __builtin_convertvector(px, v4u32) * w;
+      }
+      for (size_t i = n_vec * 4; i < len; i++)
+        tail[i - n_vec * 4] += row[i] * w;
+    }
+
+    guint8 *out = dst + (size_t)oy * len;
+    for (size_t v = 0; v < n_vec; v++) {
+      v4u8 px = __builtin_convertvector((acc[v] + SCALE_HALF) >> SCALE_SHIFT,
+                                        v4u8);
+      memcpy(out + v * 4, &px, sizeof(px));
+    }
+    for (size_t i = n_vec * 4; i < len; i++)
+      out[i] = (tail[i - n_vec * 4] + SCALE_HALF) >> SCALE_SHIFT;
+  }
+}
+
+/** Average each row of `src_w` RGB pixels down to `dst_w`. */
+static void scale_horizontal(const guint8 *src, int src_w, int rows,
+                             const ScaleFilter *f, int dst_w, guint8 *dst) {
+  for (int y = 0; y < rows; y++) {
+    const guint8 *row = src + (size_t)y * src_w * 3;
+    guint8 *out = dst + (size_t)y * dst_w * 3;
+
+    for (int ox = 0; ox < dst_w; ox++) {
+      const guint32 *w = &f->weights[(size_t)ox * f->taps];
+      const guint8 *px = row + (size_t)f->first[ox] * 3;
+      guint32 r = SCALE_HALF, g = SCALE_HALF, b = SCALE_HALF;
+
+      for (int k = 0; k < f->count[ox]; k++, px += 3) {
+        r += px[0] * w[k];
+        g += px[1] * w[k];
+        b += px[2] * w[k];
+      }
+      out[ox * 3 + 0] = r >> SCALE_SHIFT;
+      out[ox * 3 + 1] = g >> SCALE_SHIFT;
+      out[ox * 3 + 2] = b >> SCALE_SHIFT;
+    }
+  }
+}
+
+int scale_rgb_box(const guint8 *src, int src_w, int src_h, int src_stride,
+                  guint8 *dst, int dst_w, int dst_h) {
+  if (dst_w <= 0 || dst_h <= 0 || dst_w > src_w || dst_h > src_h)
+    return -1;
+
+  int ret = -1;
+  size_t len = (size_t)src_w * 3;
+  ScaleFilter fy = {0}, fx = {0};
+  v4u32 *acc = malloc((len / 4 + 1) * sizeof(*acc));
+  guint8 *tmp = malloc(len * dst_h);
+
+  if (!acc || !tmp || scale_filter_init(&fy, src_h, dst_h) != 0 ||
+      scale_filter_init(&fx, src_w, dst_w) != 0)
+    goto cleanup;
+
+  // vertical first: it touches every source byte, and vectorizes cleanly
+  scale_vertical(src, src_stride, len, &fy, dst_h, tmp, acc);
+  scale_horizontal(tmp, src_w, dst_h, &fx, dst_w, dst);
+  ret = 0;
+
+cleanup:
+  scale_filter_free(&fy);
+  scale_filter_free(&fx);
+  free(acc);
+  free(tmp);
+  return ret;
+}
@@ -0,0 +1,25 @@
+/*
+
+Area-averaging (box filter) downscaling of packed RGB8 images.
+
+Every output pixel is the exact coverage-weighted mean of the source pixels
+under it, so there is no aliasing at any ratio. The vertical pass, where
+nearly all of the work is, runs on 128-bit vectors through the compiler's
+generic vector extensions (SSE2 on x86-64, NEON on arm64).
+
+*/
+
+#ifndef __SNP_SCALE_H__
+#define __SNP_SCALE_H__
+
+#include <glib.h>
+
+/**
+ * Shrink `src` into `dst`, which holds dst_w * dst_h * 3 bytes.
+ * Only downscales: dst_w <= src_w and dst_h <= src_h.
+ * @returns 0 on success, -1 on bad dimensions or out of memory
+ */
+int scale_rgb_box(const guint8 *src, int src_w, int src_h, int src_stride,
+                  guint8 *dst, int dst_w, int dst_h);
+
+#endif /* __SNP_SCALE_H__ */
@@ -0,0 +1,174 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "screen.h"
+#include "term-util.h"
+
+void screen_init(Screen *screen) {
+  screen->valid = 0;
+  screen->n_text = 0;
+  screen->image = NULL;
+  screen->image_gen = 0;
+  screen->image_w_cells = screen->image_h_cells = 0;
+  screen->bar.width = 0;
+  sgr_state_invalidate(&screen->pen);
+}
+
+void screen_text(Screen *screen, int col, int row, guint8 attrs,
+                 const char *fmt, ...) {
+  if (screen->n_text >= SCREEN_MAX_TEXT)
+    return;
+
+  ScreenText *t = &screen->text[screen->n_text++];
+  t->col = col;
+  t->row = row;
+  t->attrs = attrs;
+
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(t->text, sizeof(t->text), fmt, args);
+  va_end(args);
+}
+
+void screen_image(Screen *screen, const GString *image, unsigned long gen,
+                  int w_cells, int h_cells) {
+  screen->image = image;
+  screen->image_gen = gen;
+  screen->image_w_cells = w_cells;
+  screen->image_h_cells = h_cells;
+}
+
+void screen_bar(Screen *screen, int col, int row, int width, int filled) {
+  screen->bar.col = col;
+  screen->bar.row = row;
+  screen->bar.width = width;
+  screen->bar.filled = CLAMP(filled, 0, width * 8);
+}
+
+/** Glyph for cell `i` of a bar; empty cells are 0, full cells 8. */
+static int screen_bar_cell(const ScreenBar *bar, int i) {
+  return CLAMP(bar->filled - i * 8, 0, 8);
+}
+
+static void screen_bar_draw(FrameBuffer *out, ChafaTermInfo *term_info,
+                            SgrState *pen, const ScreenBar *bar, int from,
+                            int to) {
+  static const char *eighths[] = {"", "\u258f", "\u258e", "\u258d", "\u258c",
+                                  "\u258b", "\u258a", "\u2589", "\u2588"};
+
+  char *p = frame_reserve(out, CHAFA_TERM_SEQ_LENGTH_MAX);
+  frame_commit(out, chafa_term_info_emit_cursor_to_pos(term_info, p,
+                                                       bar->col + from,
+                                                       bar->row));
+  for (int i = from; i < to; i++) {
+    int cell = screen_bar_cell(bar, i);
+    if (cell == 0) {
+      sgr_set_attrs(out, pen, SGR_DIM);
+      frame_append_lit(out, "\u2500");
+    } else {
+      sgr_set_attrs(out, pen, 0);
+      frame_append(out, eighths[cell], strlen(eighths[cell]));
+    }
+  }
+}
+
+static void screen_bar_present(FrameBuffer *out, ChafaTermInfo *term_info,
+                               SgrState *pen, const ScreenBar *front,
+                               const ScreenBar *back, int full) {
+  int moved = front->col != back->col || front->row != back->row ||
+              front->width != back->width;
+
+  if (!full && moved && front->width > 0) {
+    char *p = frame_reserve(out, CHAFA_TERM_SEQ_LENGTH_MAX);
+    frame_commit(out, chafa_term_info_emit_cursor_to_pos(term_info, p,
+                                                         front->col,
+                                                         front->row));
+    if (!pen->known)
+      sgr_set_attrs(out, pen, 0); // erasing fills with the background
+    frame_append_lit(out, TERM_ERASE_LINE_RIGHT);
+  }
+  if (back->width == 0)
+    return;
+  if (full || moved) {
+    screen_bar_draw(out, term_info, pen, back, 0, back->width);
+    return;
+  }
+
+  // only the cells around the fill boundary ever change
+  int from = -1, to = -1;
+  for (int i = 0; i < back->width; i++) {
+    if (screen_bar_cell(back, i) != screen_bar_cell(front, i)) {
+      if (from < 0)
+        from = i;
+      to = i + 1;
+    }
+  }
+  if (from >= 0)
+    screen_bar_draw(out, term_info, pen, back, from, to);
+}
+
+static int screen_text_equal(const ScreenText *a, const ScreenText *b) {
+  return a->col == b->col && a->row == b->row && a->attrs == b->attrs &&
+         strcmp(a->text, b->text) == 0;
+}
+
+size_t screen_present(Screen *front, const Screen *back,
+                      ChafaTermInfo *term_info, FrameBuffer *out) {
+  size_t start = out->len;
+  SgrState pen = front->pen;
+  char *p;
+
+  int full = !front->valid ||
+             front->image_w_cells != back->image_w_cells ||
+             front->image_h_cells != back->image_h_cells;
+
+  if (full) {
+    sgr_set_attrs(out, &pen, 0); // a clear fills with the current background
+    p = frame_reserve(out, CHAFA_TERM_SEQ_LENGTH_MAX);
+    frame_commit(out, chafa_term_info_emit_clear(term_info, p));
+  }
+
+  for (int i = 0; i < back->n_text; i++) {
+    const ScreenText *t = &back->text[i];
+    if (!full && i < front->n_text && screen_text_equal(t, &front->text[i]))
+      continue;
+
+    p = frame_reserve(out, CHAFA_TERM_SEQ_LENGTH_MAX);
+    frame_commit(out,
+                 chafa_term_info_emit_cursor_to_pos(term_info, p, t->col,
+                                                    t->row));
+    sgr_set_attrs(out, &pen, t->attrs);
+    frame_append(out, t->text, strlen(t->text));
+    // the old text may have been longer
+    frame_append_lit(out, TERM_ERASE_LINE_RIGHT);
+  }
+
+  // regions that no longer exist
+  for (int i = back->n_text; !full && i < front->n_text; i++) {
+    const ScreenText *t = &front->text[i];
+    p = frame_reserve(out, CHAFA_TERM_SEQ_LENGTH_MAX);
+    frame_commit(out,
+                 chafa_term_info_emit_cursor_to_pos(term_info, p, t->col,
+                                                    t->row));
+    if (!pen.known)
+      sgr_set_attrs(out, &pen, 0);
+    frame_append_lit(out, TERM_ERASE_LINE_RIGHT);
+  }
+
+  screen_bar_present(out, term_info, &pen, &front->bar, &back->bar, full);
+
+  if (back->image && (full || back->image_gen != front->image_gen)) {
+    p = frame_reserve(out, CHAFA_TERM_SEQ_LENGTH_MAX);
+    frame_commit(out, chafa_term_info_emit_cursor_to_top_left(term_info, p));
+    sgr_set_attrs(out, &pen, 0); // images are encoded from the reset state
+    frame_append(out, back->image->str, back->image->len);
+    frame_append_lit(out, "\n");
+    sgr_state_invalidate(&pen); // whatever the image left set
+  }
+
+  *front = *back;
+  front->valid = 1;
+  front->pen = pen;
+  return out->len - start;
+}
@@ -0,0 +1,84 @@
+/*
+
+Retained model of what is currently on the terminal.
+
+Each frame the UI describes the whole screen into a fresh Screen, then
+`screen_present` diffs it against the one that is already displayed and only
+writes the regions that changed. An unchanged frame writes nothing.
+
+*/
+
+#ifndef __SNP_SCREEN_H__
+#define __SNP_SCREEN_H__
+
+#include <chafa.h>
+
+#include "frame.h"
+#include "sgr.h"
+
+#define SCREEN_MAX_TEXT 8
+#define SCREEN_TEXT_LEN 512
+
+/** A line of plain text in one style, anchored at a 1-based cell position. */
+typedef struct {
+  int col, row;
+  /** SGR_* attributes the whole line is drawn with. */
+  guint8 attrs;
+  char text[SCREEN_TEXT_LEN];
+} ScreenText;
+
+/** Horizontal bar `width` cells wide, `filled` eighths of a cell full. */
+typedef struct {
+  int col, row, width;
+  int filled;
+} ScreenBar;
+
+typedef struct {
+  /** Set once the screen has been presented; cleared to force a full redraw */
+  int valid;
+
+  ScreenText text[SCREEN_MAX_TEXT];
+  int n_text;
+
+  /** Printed image anchored at the top left. Not owned by the screen. */
+  const GString *image;
+  /** Changes whenever `image` holds different bytes; 0 means no image. */
+  unsigned long image_gen;
+  int image_w_cells, image_h_cells;
+
+  /** Progress bar; width 0 means none. Diffed cell by cell. */
+  ScreenBar bar;
+
+  /**
+   * The terminal's attribute state, so styles are only switched when they
+   * differ. Only meaningful on the front screen.
+   */
+  SgrState pen;
+} Screen;
+
+/** Reset `screen` to an empty frame. */
+void screen_init(Screen *screen);
+
+/**
+ * Append a text region drawn with `attrs` (SGR_BOLD etc., or 0). Regions past
+ * SCREEN_MAX_TEXT are dropped.
+ */
+void screen_text(Screen *screen, int col, int row, guint8 attrs,
+                 const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+
+void screen_image(Screen *screen, const GString *image, unsigned long gen,
+                  int w_cells, int h_cells);
+
+void screen_bar(Screen *screen, int col, int row, int width, int filled);
+
+/**
+ * Append the difference between `front` (what is displayed) and `back` (what
+ * should be displayed) to `out`, then make `back` the new front.
+ * A change in image size, or an invalid front, clears the screen and redraws
+ * everything.
+ * @returns number of bytes appended
+ */
+size_t screen_present(Screen *front, const Screen *back,
+                      ChafaTermInfo *term_info, FrameBuffer *out);
+
+#endif /* __SNP_SCREEN_H__ */
@@ -0,0 +1,298 @@
+#include <string.h>
+
+#include "sgr.h"
+
+/** Attributes sharing one "off" code, and that code. */
+static const struct {
+  guint8 attrs;
+  guint8 off;
+} sgr_offs[] = {
+    {SGR_BOLD | SGR_DIM, 22},
+    {SGR_ITALIC, 23},
+    {SGR_UNDERLINE, 24},
+    {SGR_INVERSE, 27},
+};
+
+static const struct {
+  guint8 attr;
+  guint8 on;
+} sgr_ons[] = {
+    {SGR_BOLD, 1}, {SGR_DIM, 2}, {SGR_ITALIC, 3}, {SGR_UNDERLINE, 4},
+    {SGR_INVERSE, 7},
+};
+
+void sgr_state_reset(SgrState *state) {
+  state->known = TRUE;
+  state->attrs = 0;
+  state->fg = state->bg = SGR_COLOR_DEFAULT;
+}
+
+void sgr_state_invalidate(SgrState *state) {
+  sgr_state_reset(state);
+  state->known = FALSE;
+}
+
+static char *sgr_put_uint(char *p, unsigned v) {
+  if (v >= 100)
+    *p++ = '0' + v / 100;
+  if (v >= 10)
+    *p++ = '0' + v / 10 % 10;
+  *p++ = '0' + v % 10;
+  return p;
+}
+
+/** Append parameter `v`, preceded by a separator unless it is the first. */
+static char *sgr_put_param(char *p, char *start, unsigned v) {
+  if (p != start)
+    *p++ = ';';
+  return sgr_put_uint(p, v);
+}
+
+/** Parameters selecting colour `c` as foreground (base 30) or bg (40). */
+static char *sgr_put_color(char *p, char *start, int base, guint32 c) {
+  if (c == SGR_COLOR_DEFAULT)
+    return sgr_put_param(p, start, base + 9);
+
+  if (c & 0x01000000u) {
+    unsigned i = c & 0xff;
+    if (i < 8)
+      return sgr_put_param(p, start, base + i);
+    if (i < 16)
+      return sgr_put_param(p, start, base + 60 + i - 8);
+    p = sgr_put_param(p, start, base + 8);
+    p = sgr_put_param(p, start, 5);
+    return sgr_put_param(p, start, i);
+  }
+
+  p = sgr_put_param(p, start, base + 8);
+  p = sgr_put_param(p, start, 2);
+  p = sgr_put_param(p, start, (c >> 16) & 0xff);
+  p = sgr_put_param(p, start, (c >> 8) & 0xff);
+  return sgr_put_param(p, start, c & 0xff);
+}
+
+/** Parameters for `want` starting from `cur` (which must be known). */
+static char *sgr_put_delta(char *p, const SgrState *cur, const SgrState *want) {
+  char *start = p;
+  guint8 on = want->attrs & ~cur->attrs;
+
+  for (size_t i = 0; i < G_N_ELEMENTS(sgr_offs); i++) {
+    if (cur->attrs & ~want->attrs & sgr_offs[i].attrs) {
+      p = sgr_put_param(p, start, sgr_offs[i].off);
+      on |= want->attrs & sgr_offs[i].attrs; // 22 clears bold and dim both
+    }
+  }
+  for (size_t i = 0; i < G_N_ELEMENTS(sgr_ons); i++)
+    if (on & sgr_ons[i].attr)
+      p = sgr_put_param(p, start, sgr_ons[i].on);
+
+  if (want->fg != cur->fg)
+    p = sgr_put_color(p, start, 30, want->fg);
+  if (want->bg != cur->bg)
+    p = sgr_put_color(p, start, 40, want->bg);
+  return p;
+}
+
+char *sgr_emit(char *dest, SgrState *cur, const SgrState *want) {
+  if (cur->known && cur->attrs == want->attrs && cur->fg == want->fg &&
+      cur->bg == want->bg)
+    return dest;
+
+  // either the delta from cur, or a reset followed by the delta from reset;
+  // a leading empty parameter means 0, so ESC[;1m resets and sets bold
+  char delta[SGR_SEQ_LENGTH_MAX], reset[SGR_SEQ_LENGTH_MAX];
+  SgrState zero;
+  sgr_state_reset(&zero);
+
+  const char *params = reset;
+  size_t len = sgr_put_delta(reset + 1, &zero, want) - (reset + 1);
+  if (len > 0) {
+    reset[0] = ';';
+    len++;
+  }
+
+  if (cur->known) {
+    size_t delta_len = sgr_put_delta(delta, cur, want) - delta;
+    if (delta_len <= len) {
+      params = delta;
+      len = delta_len;
+    }
+  }
+
+  *dest++ = '\033';
+  *dest++ = '[';
+  memcpy(dest, params, len);
+  dest += len;
+  *dest++ = 'm';
+
+  *cur = *want;
+  cur->known = TRUE;
+  return dest;
+}
+
+void sgr_set_attrs(FrameBuffer *out, SgrState *cur, guint8 attrs) {
+  SgrState want;
+  sgr_state_reset(&want);
+  want.attrs = attrs;
+  char *p = frame_reserve(out, SGR_SEQ_LENGTH_MAX);
+  frame_commit(out, sgr_emit(p, cur, &want));
+}
+
+/** Read one numeric parameter; empty ones are 0. */
+static const char *sgr_parse_uint(const char *p, const char *end,
+                                  unsigned *v) {
+  *v = 0;
+  while (p < end && *p >= '0' && *p <= '9')
+    *v = *v * 10 + (*p++ - '0');
+  if (p < end && *p == ';')
+    p++;
+  return p;
+}
+
+/** Extended colour after 38/48. @returns FALSE if malformed */
+static gboolean sgr_parse_color(const char **p, const char *end,
+                                guint32 *color) {
+  unsigned kind, r, g, b;
+  *p = sgr_parse_uint(*p, end, &kind);
+  if (kind == 5) {
+    *p = sgr_parse_uint(*p, end, &r);
+    *color = SGR_COLOR_INDEX(r & 0xff);
+    return TRUE;
+  }
+  if (kind == 2) {
+    *p = sgr_parse_uint(*p, end, &r);
+    *p = sgr_parse_uint(*p, end, &g);
+    *p = sgr_parse_uint(*p, end, &b);
+    *color = SGR_COLOR_RGB(r & 0xff, g & 0xff, b & 0xff);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ * Apply the parameters of one SGR sequence to `state`.
+ * @returns FALSE if it contains anything this module does not track
+ */
+static gboolean sgr_apply(SgrState *state, const char *p, const char *end) {
+  if (p == end) {
+    sgr_state_reset(state);
+    return TRUE;
+  }
+
+  while (p < end) {
+    unsigned v;
+    p = sgr_parse_uint(p, end, &v);
+    switch (v) {
+    case 0:
+      sgr_state_reset(state);
+      break;
+    case 1:
+      state->attrs |= SGR_BOLD;
+      break;
+    case 2:
+      state->attrs |= SGR_DIM;
+      break;
+    case 3:
+      state->attrs |= SGR_ITALIC;
+      break;
+    case 4:
+      state->attrs |= SGR_UNDERLINE;
+      break;
+    case 7:
+      state->attrs |= SGR_INVERSE;
+      break;
+    case 22:
+      state->attrs &= ~(SGR_BOLD | SGR_DIM);
+      break;
+    case 23:
+      state->attrs &= ~SGR_ITALIC;
+      break;
+    case 24:
+      state->attrs &= ~SGR_UNDERLINE;
+      break;
+    case 27:
+      state->attrs &= ~SGR_INVERSE;
+      break;
+    case 38:
+      if (!sgr_parse_color(&p, end, &state->fg))
+        return FALSE;
+      break;
+    case 39:
+      state->fg = SGR_COLOR_DEFAULT;
+      break;
+    case 48:
+      if (!sgr_parse_color(&p, end, &state->bg))
+        return FALSE;
+      break;
+    case 49:
+      state->bg = SGR_COLOR_DEFAULT;
+      break;
+    default:
+      if (v >= 30 && v <= 37)
+        state->fg = SGR_COLOR_INDEX(v - 30);
+      else if (v >= 40 && v <= 47)
+        state->bg = SGR_COLOR_INDEX(v - 40);
+      else if (v >= 90 && v <= 97)
+        state->fg = SGR_COLOR_INDEX(v - 90 + 8);
+      else if (v >= 100 && v <= 107)
+        state->bg = SGR_COLOR_INDEX(v - 100 + 8);
+      else
+        return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+void sgr_reencode(FrameBuffer *out, const char *in, size_t len) {
+  const char *end = in + len;
+  SgrState cur, want;
+  sgr_state_reset(&cur);
+  sgr_state_reset(&want);
+
+  frame_reserve(out, len);
+  const char *p = in;
+  while (p < end) {
+    const char *run = p;
+
+    // text and line breaks go through as they are; only SGR is rewritten
+    if (*p != '\033') {
+      if (*p != '\n' && *p != '\r') {
+        char *q = frame_reserve(out, SGR_SEQ_LENGTH_MAX);
+        frame_commit(out, sgr_emit(q, &cur, &want));
+      }
+      while (p < end && *p != '\033' && *p != '\n' && *p != '\r')
+        p++;
+      if (p == run)
+        p++;
+      frame_append(out, run, p - run);
+      continue;
+    }
+
+    // a CSI with only numeric parameters, ending in m, is SGR
+    const char *params = p + 2, *q = params;
+    if (end - p >= 2 && p[1] == '[') {
+      while (q < end && (*q == ';' || (*q >= '0' && *q <= '9')))
+        q++;
+      if (q < end && *q == 'm') {
+        SgrState next = want;
+        if (sgr_apply(&next, params, q)) {
+          want = next;
+          p = q + 1;
+          continue;
+        }
+      }
+    }
+
+    // something this module does not understand: sync up, then hand the
+    // rest over untouched, since it may depend on state we do not track
+    char *e = frame_reserve(out, SGR_SEQ_LENGTH_MAX);
+    frame_commit(out, sgr_emit(e, &cur, &want));
+    frame_append(out, p, end - p);
+    return;
+  }
+
+  SgrState reset;
+  sgr_state_reset(&reset);
+  char *e = frame_reserve(out, SGR_SEQ_LENGTH_MAX);
+  frame_commit(out, sgr_emit(e, &cur, &reset));
+}
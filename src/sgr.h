@@ -0,0 +1,70 @@
+/*
+
+Attribute and colour state of the terminal, and the shortest SGR sequence to
+get from one state to another.
+
+Everything drawn goes through an SgrState "pen" that mirrors what the terminal
+currently has set, so text and images only send the attributes and colours
+that actually change, instead of opening and closing them around every string.
+Symbol-mode images from chafa are re-encoded the same way before they are
+cached: redundant colour sets and the resets at the end of every row are
+dropped.
+
+*/
+
+#ifndef __SNP_SGR_H__
+#define __SNP_SGR_H__
+
+#include <glib.h>
+
+#include "frame.h"
+
+#define SGR_BOLD 0x01
+#define SGR_DIM 0x02
+#define SGR_ITALIC 0x04
+#define SGR_UNDERLINE 0x08
+#define SGR_INVERSE 0x10
+
+/** Colours: the terminal default, a palette index, or 24-bit direct. */
+#define SGR_COLOR_DEFAULT 0u
+#define SGR_COLOR_INDEX(i) (0x01000000u | (guint32)(i))
+#define SGR_COLOR_RGB(r, g, b)                                                 \
+  (0x02000000u | (guint32)(r) << 16 | (guint32)(g) << 8 | (guint32)(b))
+
+/** Longest sequence sgr_emit writes: every attribute and two RGB colours. */
+#define SGR_SEQ_LENGTH_MAX 64
+
+typedef struct {
+  /** FALSE when the terminal state is unknown; the next change resets first */
+  gboolean known;
+  guint8 attrs;
+  guint32 fg, bg;
+} SgrState;
+
+/** The state after a reset (ESC[0m). */
+void sgr_state_reset(SgrState *state);
+/** Unknown state, e.g. after output that did not go through the pen. */
+void sgr_state_invalidate(SgrState *state);
+
+/**
+ * Write the shortest SGR sequence that turns `cur` into `want` to `dest`
+ * (which must hold SGR_SEQ_LENGTH_MAX bytes), then update `cur`. Writes
+ * nothing when they already match.
+ * @returns the new end of `dest`
+ */
+char *sgr_emit(char *dest, SgrState *cur, const SgrState *want);
+
+/** Switch `cur` to `attrs` on default colours, appending to `out`. */
+void sgr_set_attrs(FrameBuffer *out, SgrState *cur, guint8 attrs);
+
+/**
+ * Append `in` (text with SGR sequences, as printed by chafa) to `out`,
+ * rewritten so each cell only sends the state changes it needs. Changes are
+ * deferred to the next visible character, so a reset at the end of one row
+ * and the colours at the start of the next collapse into one delta; line
+ * breaks are assumed not to scroll. `in` is taken to start from, and `out`
+ * is left in, the reset state. Anything but plain SGR is copied verbatim.
+ */
+void sgr_reencode(FrameBuffer *out, const char *in, size_t len);
+
+#endif /* __SNP_SGR_H__ */
@@ -0,0 +1,71 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_IDLE ULONG_MAX
+
+struct SnapshotRetired {
+  void *snapshot;
+  unsigned long epoch;
+  SnapshotRetired *next;
+};
+
+void snapshot_slot_init(SnapshotSlot *slot, void (*free_fn)(void *snapshot)) {
+  atomic_init(&slot->latest, NULL);
+  atomic_init(&slot->epoch, 1);
+  atomic_init(&slot->reader_epoch, SNAPSHOT_IDLE);
+  slot->retired = NULL;
+  slot->free_fn = free_fn;
+}
+
+/** Free every retired snapshot the consumer can no longer be looking at. */
+static void snapshot_reclaim(SnapshotSlot *slot) {
+  unsigned long pinned = atomic_load(&slot->reader_epoch);
+
+  SnapshotRetired **link = &slot->retired;
+  while (*link) {
+    SnapshotRetired *r = *link;
+    if (pinned == SNAPSHOT_IDLE || pinned >= r->epoch) {
+      *link = r->next;
+      slot->free_fn(r->snapshot);
+      free(r);
+    } else {
+      link = &r->next;
+    }
+  }
+}
+
+void snapshot_slot_destroy(SnapshotSlot *slot) {
+  atomic_store(&slot->reader_epoch, SNAPSHOT_IDLE);
+  snapshot_reclaim(slot);
+
+  void *latest = atomic_exchange(&slot->latest, NULL);
+  if (latest)
+    slot->free_fn(latest);
+}
+
+void snapshot_publish(SnapshotSlot *slot, void *snapshot) {
+  void *old = atomic_exchange(&slot->latest, snapshot);
+  // only bumped after the swap: a consumer pinning this epoch or later has
+  // certainly seen the new snapshot
+  unsigned long epoch = atomic_fetch_add(&slot->epoch, 1) + 1;
+
+  if (old) {
+    SnapshotRetired *r = malloc(sizeof(*r));
+    r->snapshot = old;
+    r->epoch = epoch;
+    r->next = slot->retired;
+    slot->retired = r;
+  }
+  snapshot_reclaim(slot);
+}
+
+void *snapshot_acquire(SnapshotSlot *slot) {
+  atomic_store(&slot->reader_epoch, atomic_load(&slot->epoch));
+  return atomic_load(&slot->latest);
+}
+
+void snapshot_release(SnapshotSlot *slot) {
+  atomic_store(&slot->reader_epoch, SNAPSHOT_IDLE);
+}
@@ -0,0 +1,55 @@
+/*
+
+Lock-free handoff of immutable snapshots from one producer thread to one
+consumer thread.
+
+The producer publishes a new snapshot by swapping it into the slot; the
+consumer reads the latest one between snapshot_acquire and snapshot_release.
+Neither side ever waits on the other.
+
+Superseded snapshots are reclaimed with a simple epoch scheme: every publish
+advances a global epoch and retires the old snapshot under it, and the
+consumer advertises the epoch it pinned while it holds a snapshot. The
+producer frees a retired snapshot once the consumer is idle or has pinned an
+epoch at or past the one it was retired in, since from then on the consumer
+can only see newer snapshots.
+
+*/
+
+#ifndef __SNP_SNAPSHOT_H__
+#define __SNP_SNAPSHOT_H__
+
+#include <stdatomic.h>
+
+typedef struct SnapshotRetired SnapshotRetired;
+
+typedef struct {
+  _Atomic(void *) latest;
+  atomic_ulong epoch;
+  /** Epoch pinned by the consumer, or SNAPSHOT_IDLE. */
+  atomic_ulong reader_epoch;
+
+  /** Producer-private list of superseded snapshots awaiting reclamation. */
+  SnapshotRetired *retired;
+  void (*free_fn)(void *snapshot);
+} SnapshotSlot;
+
+void snapshot_slot_init(SnapshotSlot *slot, void (*free_fn)(void *snapshot));
+
+/** Free everything left in the slot. Both threads must have stopped. */
+void snapshot_slot_destroy(SnapshotSlot *slot);
+
+/**
+ * Producer: make `snapshot` the latest. The slot takes ownership, and the
+ * snapshot must not be modified afterwards.
+ */
+void snapshot_publish(SnapshotSlot *slot, void *snapshot);
+
+/**
+ * Consumer: the latest snapshot (or NULL if none was published yet). It stays
+ * valid until the matching snapshot_release.
+ */
+void *snapshot_acquire(SnapshotSlot *slot);
+void snapshot_release(SnapshotSlot *slot);
+
+#endif /* __SNP_SNAPSHOT_H__ */
@@ -22,6 +22,11 @@ ResponseBuffer *response_buffer_new_with_size(size_t size) {
   if (!buf)
     return buf;
   buf->contents = malloc(size + 1); // null-terminated
+  if (!buf->contents) {
+    free(buf);
+    return NULL;
+  }
+  buf->contents[0] = 0; // printable even if nothing is ever written
   buf->size = 0;
   return buf;
 }
@@ -73,22 +78,24 @@ struct spotify_auth_cb_params {
 
 int spotify_auth_http_callback(HttpRequest *req, HttpResponse *res, void *out) {
   struct spotify_auth_cb_params *params = out;
-  if (strcmp(req->path, "/") == 0 && req->method == HTTP_METHOD_GET) {
-    const char *code = http_request_query_get(req, "code");
-    if (code) {
-      strcpy(params->res, code);
+  if (http_request_path_is(req, "/") && req->method == HTTP_METHOD_GET) {
+    if (http_request_query_get(req, "code", params->res,
+                               sizeof(params->res))) {
       params->success = 1;
 
+      static const char success[] = "Success! You can close this tab now.";
       res->code = 200;
-      sprintf(res->body, "Success! You can close this tab now.");
+      http_response_body(res, success, sizeof(success) - 1, NULL, NULL);
     } else {
-      const char *error = http_request_query_get(req, "error");
-      strcpy(params->res, error);
+      if (!http_request_query_get(req, "error", params->res,
+                                  sizeof(params->res)))
+        strcpy(params->res, "no code in callback");
       params->success = 0;
 
       res->code = 401;
-      sprintf(res->body, "One of us goofed, and it wasnt me.<br><pre>%s</pre>",
-              error);
+      http_response_printf(
+          res, "One of us goofed, and it wasnt me.<br><pre>%s</pre>",
+          params->res);
     }
 
     return 1;
@@ -201,28 +208,44 @@ void spotify_auth_refresh_if_required(SpotifyAuth *auth) {
   // TODO: implement
 }
 
-json_t *spotify_api_get(const char *endpoint, SpotifyAuth *auth) {
-  if (!auth) {
-    fprintf(stderr, "no auth session found\n");
-    exit(1);
-  }
-  spotify_auth_refresh_if_required(auth);
-
-  CURL *curl = curl_easy_init();
-  CURLcode res;
-
+struct curl_slist *spotify_api_prepare(CURL *curl, const char *endpoint,
+                                       const SpotifyAuth *auth,
+                                       ResponseBuffer *response) {
   curl_easy_setopt(curl, CURLOPT_URL, endpoint);
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 
   char authorization_header[512];
-  sprintf(authorization_header, "Authorization: Bearer %s", auth->access_token);
+  snprintf(authorization_header, sizeof(authorization_header),
+           "Authorization: Bearer %s", auth->access_token);
   struct curl_slist *headers = curl_slist_append(NULL, authorization_header);
   curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-  ResponseBuffer *response = response_buffer_new();
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
                    response_buffer_libcurl_write_function);
+  return headers;
+}
+
+/**
+ * GET `endpoint` as `auth`.
+ * @returns the parsed response, or NULL if it was empty or did not parse, or
+ * if the request failed, which sets *failed
+ */
+static json_t *spotify_api_request(const char *endpoint, SpotifyAuth *auth,
+                                   int *failed) {
+  *failed = 0;
+  if (!auth) {
+    fprintf(stderr, "no auth session found\n");
+    *failed = 1;
+    return NULL;
+  }
+  spotify_auth_refresh_if_required(auth);
+
+  CURL *curl = curl_easy_init();
+  CURLcode res;
+  ResponseBuffer *response = response_buffer_new();
+  struct curl_slist *headers =
+      spotify_api_prepare(curl, endpoint, auth, response);
 
   if ((res = curl_easy_perform(curl)) != CURLE_OK) {
     fprintf(stderr, "spotify api network request failed: %s\n",
@@ -240,6 +263,7 @@ json_t *spotify_api_get(const char *endpoint, SpotifyAuth *auth) {
   curl_easy_cleanup(curl);
 
   if (response->size == 0) {
+    response_buffer_free(response);
     return NULL;
   }
 
@@ -256,7 +280,22 @@ json_t *spotify_api_get(const char *endpoint, SpotifyAuth *auth) {
 cleanup_curl:
   curl_slist_free_all(headers);
   curl_easy_cleanup(curl);
-  exit(1);
+  response_buffer_free(response);
+  *failed = 1;
+  return NULL;
+}
+
+json_t *spotify_api_get(const char *endpoint, SpotifyAuth *auth) {
+  int failed;
+  json_t *root = spotify_api_request(endpoint, auth, &failed);
+  if (failed)
+    exit(1);
+  return root;
+}
+
+json_t *spotify_api_try_get(const char *endpoint, SpotifyAuth *auth) {
+  int failed;
+  return spotify_api_request(endpoint, auth, &failed);
 }
 
 SpotifyAlbumCover *spotify_album_cover_from_jpeg(ResponseBuffer *buf) {
@@ -273,20 +312,38 @@ SpotifyAlbumCover *spotify_album_cover_from_jpeg(ResponseBuffer *buf) {
   ret = malloc(sizeof(*ret));
   ret->width = njGetWidth();
   ret->height = njGetHeight();
-  response_buffer_set_bytes(buf, (char *)njGetImage(), njGetImageSize());
+  ret->url = NULL;
+  ret->scaled = NULL;
+  ret->scaled_width = ret->scaled_height = 0;
+  atomic_init(&ret->refs, 1);
+  ret->pixels = malloc(njGetImageSize());
+  memcpy(ret->pixels, njGetImage(), njGetImageSize());
   njDone();
-  ret->pixels = (unsigned char *)buf->contents;
-
+  // the buffer is kept as the JPEG itself
+  ret->jpeg = (unsigned char *)buf->contents;
+  ret->jpeg_size = buf->size;
   free(buf);
+  return ret;
 
 cleanup:
+  njDone();
+  response_buffer_free(buf);
   return ret;
 }
 
+SpotifyAlbumCover *spotify_album_cover_ref(SpotifyAlbumCover *album) {
+  if (album)
+    atomic_fetch_add(&album->refs, 1);
+  return album;
+}
+
 void spotify_album_cover_free(SpotifyAlbumCover *album) {
-  if (!album)
+  if (!album || atomic_fetch_sub(&album->refs, 1) != 1)
     return;
   free(album->pixels);
+  free(album->scaled);
+  free(album->url);
+  free(album->jpeg);
   free(album);
 }
 
@@ -320,32 +377,59 @@ ResponseBuffer *response_buffer_new_from_url(const char *url) {
 
 cleanup:
   curl_easy_cleanup(curl);
+  if (!ret)
+    response_buffer_free(response);
   return ret;
 }
 
-SpotifyCurrentlyPlaying *spotify_currently_playing_get(SpotifyAuth *auth) {
-  SpotifyCurrentlyPlaying *ret = malloc(sizeof(*ret));
-  json_t *root = spotify_api_get(SNP_SPOTIFY_API_CURRENTLY_PLAYING, auth);
+SpotifyAlbumCover *spotify_album_cover_fetch(const char *url) {
+  SpotifyAlbumCover *cover =
+      spotify_album_cover_from_jpeg(response_buffer_new_from_url(url));
+  if (cover)
+    cover->url = strdup(url);
+  return cover;
+}
+
+/**
+ * An image of an item: a track's album art, or an episode's own. Spotify
+ * lists them largest first.
+ */
+static const char *spotify_item_image_url(json_t *item, int smallest) {
+  json_t *images = json_object_get(json_object_get(item, "album"), "images");
+  if (!images)
+    images = json_object_get(item, "images");
+  size_t n = json_array_size(images);
+  if (!n)
+    return NULL;
+  return json_string_value(
+      json_object_get(json_array_get(images, smallest ? n - 1 : 0), "url"));
+}
+
+SpotifyCurrentlyPlaying *spotify_currently_playing_from_json(json_t *root) {
+  SpotifyCurrentlyPlaying *ret = calloc(1, sizeof(*ret));
+  // anchor progress to our own clock: the response's `timestamp` is the
+  // server's wall clock, and is not updated on every request either
+  clock_gettime(CLOCK_MONOTONIC, &ret->fetched_at);
   ret->__root = root;
-  if (!root) {
-    printf("Nothing is playing...\n");
-    return ret;
-  }
+  if (!root)
+    return ret; // nothing is playing
 
   const char *track_type =
       json_string_value(json_object_get(root, "currently_playing_type"));
-  if (strcmp(track_type, "track") != 0) {
-    printf("Item being played is not a track.\n");
-    return ret;
-  }
+  if (!track_type || strcmp(track_type, "track") != 0)
+    return ret; // e.g. an episode or an ad
 
   json_t *item = json_object_get(root, "item");
   json_t *album = json_object_get(item, "album");
 
-  const char *album_url = json_string_value(json_object_get(
-      json_array_get(json_object_get(album, "images"), 0), "url"));
+  ret->cover_url = spotify_item_image_url(item, 0);
+  ret->cover_preview_url = spotify_item_image_url(item, 1);
+  ret->id = json_string_value(json_object_get(item, "id"));
   ret->album_name = json_string_value(json_object_get(album, "name"));
   ret->track_name = json_string_value(json_object_get(item, "name"));
+  ret->is_playing = json_is_true(json_object_get(root, "is_playing"));
+  ret->progress_ms = json_integer_value(json_object_get(root, "progress_ms"));
+  ret->duration_ms = json_integer_value(json_object_get(item, "duration_ms"));
 
   size_t artist_i;
   json_t *artist;
@@ -354,10 +438,24 @@ SpotifyCurrentlyPlaying *spotify_currently_playing_get(SpotifyAuth *auth) {
       break;
     ret->artists[artist_i] = json_string_value(json_object_get(artist, "name"));
   }
+  return ret;
+}
 
-  ResponseBuffer *img_buf = response_buffer_new_from_url(album_url);
-  ret->album_cover = spotify_album_cover_from_jpeg(img_buf);
+SpotifyCurrentlyPlaying *spotify_currently_playing_get(SpotifyAuth *auth) {
+  SpotifyCurrentlyPlaying *ret = spotify_currently_playing_from_json(
+      spotify_api_get(SNP_SPOTIFY_API_CURRENTLY_PLAYING, auth));
+  if (ret->cover_url)
+    ret->album_cover = spotify_album_cover_fetch(ret->cover_url);
+  return ret;
+}
 
+SpotifyCurrentlyPlaying *
+spotify_currently_playing_copy(const SpotifyCurrentlyPlaying *playing) {
+  SpotifyCurrentlyPlaying *ret = malloc(sizeof(*ret));
+  *ret = *playing;
+  // the strings point into the json, which lives as long as its last copy
+  json_incref(ret->__root);
+  spotify_album_cover_ref(ret->album_cover);
   return ret;
 }
 
@@ -368,3 +466,16 @@ void spotify_currently_playing_free(SpotifyCurrentlyPlaying *playing) {
   spotify_album_cover_free(playing->album_cover);
   free(playing);
 }
+
+size_t spotify_queue_cover_urls(json_t *queue, const char **urls, size_t n) {
+  size_t found = 0, i;
+  json_t *item;
+  json_array_foreach(json_object_get(queue, "queue"), i, item) {
+    if (found == n)
+      break;
+    const char *url = spotify_item_image_url(item, 0);
+    if (url)
+      urls[found++] = url;
+  }
+  return found;
+}
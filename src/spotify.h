@@ -3,6 +3,7 @@
 
 #include <curl/curl.h>
 #include <jansson.h>
+#include <stdatomic.h>
 #include <time.h>
 
 /** Null-terminated resizable buffer. */
@@ -44,14 +45,55 @@ typedef struct {
 SpotifyAuth *spotify_auth_new_from_oauth(void);
 void spotify_auth_free(SpotifyAuth *auth);
 
+/**
+ * GET `endpoint` as `auth`. Exits if the request fails.
+ * @returns the parsed response, or NULL if it was empty
+ */
 json_t *spotify_api_get(const char *endpoint, SpotifyAuth *auth);
+/**
+ * Like spotify_api_get, but for requests that may fail.
+ * @returns NULL on error too
+ */
+json_t *spotify_api_try_get(const char *endpoint, SpotifyAuth *auth);
+
+/**
+ * Set `curl` up for a GET of `endpoint` as `auth`, with the body written to
+ * `response`, for running it elsewhere (e.g. on a multi handle).
+ * @returns the request headers; free them once the transfer is done
+ */
+struct curl_slist *spotify_api_prepare(CURL *curl, const char *endpoint,
+                                       const SpotifyAuth *auth,
+                                       ResponseBuffer *response);
 
 typedef struct {
   int width;
   int height;
   unsigned char *pixels;
+  /** Source url; stable across polls, so it doubles as the cover's identity */
+  char *url;
+  /** The JPEG as downloaded, for handing on without re-encoding. */
+  unsigned char *jpeg;
+  size_t jpeg_size;
+  /**
+   * The pixels already shrunk to scaled_width x scaled_height for the
+   * canvas, or NULL. Only set before the cover is first shared.
+   */
+  unsigned char *scaled;
+  int scaled_width, scaled_height;
+  /** Covers are immutable once shared, and shared between snapshots. */
+  atomic_int refs;
 } SpotifyAlbumCover;
+/** Decode `buf`, which the cover takes over (or frees, on error). */
 SpotifyAlbumCover *spotify_album_cover_from_jpeg(ResponseBuffer *buf);
+/**
+ * Download and decode the cover at `url`. Not thread-safe: the decoder is
+ * global.
+ * @returns NULL on error
+ */
+SpotifyAlbumCover *spotify_album_cover_fetch(const char *url);
+/** Take another reference to `album`. */
+SpotifyAlbumCover *spotify_album_cover_ref(SpotifyAlbumCover *album);
+/** Drop a reference, freeing the cover with the last one. */
 void spotify_album_cover_free(SpotifyAlbumCover *album);
 
 typedef struct {
@@ -59,10 +101,39 @@ typedef struct {
   const char *album_name;
   const char *track_name;
   const char *artists[3];
+  /** Largest of the album's images. */
+  const char *cover_url;
+  /** Smallest of them, quick to fetch while the cover is on its way. */
+  const char *cover_preview_url;
   SpotifyAlbumCover *album_cover;
+
+  int is_playing;
+  long progress_ms;
+  long duration_ms;
+  /** CLOCK_MONOTONIC time the response arrived; progress_ms was true then. */
+  struct timespec fetched_at;
+
   json_t *__root;
 } SpotifyCurrentlyPlaying;
 SpotifyCurrentlyPlaying *spotify_currently_playing_get(SpotifyAuth *auth);
+/**
+ * Read a currently-playing response (NULL: nothing is playing), taking
+ * ownership of `root`. Leaves album_cover for the caller to fetch.
+ */
+SpotifyCurrentlyPlaying *spotify_currently_playing_from_json(json_t *root);
+/**
+ * Another snapshot of the same response, sharing its json and cover, e.g.
+ * to publish again with a better cover.
+ */
+SpotifyCurrentlyPlaying *
+spotify_currently_playing_copy(const SpotifyCurrentlyPlaying *playing);
 void spotify_currently_playing_free(SpotifyCurrentlyPlaying *playing);
 
+/**
+ * Cover urls of the first `n` items of a queue response (see
+ * SNP_SPOTIFY_API_QUEUE), next up first. They point into `queue`.
+ * @returns how many were found
+ */
+size_t spotify_queue_cover_urls(json_t *queue, const char **urls, size_t n);
+
 #endif /* __SNP_SPOTIFY_H__ */
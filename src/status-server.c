@@ -0,0 +1,278 @@
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cover-cache.h"
+#include "http-server.h"
+#include "status-server.h"
+
+/** The last state pushed, shared with responses still being sent. */
+typedef struct {
+  atomic_uint refs;
+  size_t len;
+  char data[];
+} StatusJson;
+
+static void status_json_unref(void *json) {
+  StatusJson *j = json;
+  if (j && atomic_fetch_sub(&j->refs, 1) == 1)
+    free(j);
+}
+
+struct StatusServer {
+  HttpServer *http;
+  pthread_t thread;
+  CoverCache *covers;
+
+  /** Guards `latest`, which the poller swaps and the server thread reads. */
+  pthread_mutex_t lock;
+  StatusJson *latest;
+
+  /** Last state pushed, to tell what changed; poller thread only. */
+  int published;
+  char id[64];
+  int is_playing;
+  long progress_ms;
+  struct timespec fetched_at;
+  /** Of the cover pushed, or empty; the preview and the cover differ. */
+  char cover_url[256];
+};
+
+/** Covers are served at STATUS_COVER_PREFIX <hash> STATUS_COVER_SUFFIX. */
+#define STATUS_COVER_PREFIX "/covers/"
+#define STATUS_COVER_SUFFIX ".jpg"
+
+static void status_close_fd(void *fd) { close((int)(intptr_t)fd); }
+
+/**
+ * The cover name in the request's path, if it asks for one.
+ * @returns FALSE if it does not
+ */
+static int status_cover_path(const HttpRequest *request,
+                             char hash[COVER_HASH_LENGTH + 1]) {
+  const size_t prefix = sizeof(STATUS_COVER_PREFIX) - 1;
+  const char *path = request->buf + request->path.off;
+  if (request->path.len != prefix + COVER_HASH_LENGTH +
+                               sizeof(STATUS_COVER_SUFFIX) - 1 ||
+      memcmp(path, STATUS_COVER_PREFIX, prefix) != 0 ||
+      memcmp(path + prefix + COVER_HASH_LENGTH, STATUS_COVER_SUFFIX,
+             sizeof(STATUS_COVER_SUFFIX) - 1) != 0)
+    return 0;
+  memcpy(hash, path + prefix, COVER_HASH_LENGTH);
+  hash[COVER_HASH_LENGTH] = 0;
+  return 1;
+}
+
+/** Serve a cover by name, from disk or memory, cached for good. */
+static void status_serve_cover(StatusServer *server, HttpRequest *request,
+                               HttpResponse *response, const char *hash) {
+  // the name is the content, so whatever copy the client has is current
+  size_t match_len;
+  const char *match =
+      http_request_header_get(request, "If-None-Match", &match_len);
+  CoverCacheHit hit;
+  if (match && match_len == COVER_HASH_LENGTH + 2 && match[0] == '"' &&
+      memcmp(match + 1, hash, COVER_HASH_LENGTH) == 0) {
+    response->code = 304;
+    response->content_type = NULL;
+  } else if (cover_cache_open(server->covers, hash, &hit) == 0) {
+    response->code = 200;
+    response->content_type = "image/jpeg";
+    if (hit.bytes)
+      http_response_body(response, hit.bytes->data, hit.len,
+                         cover_bytes_unref, hit.bytes);
+    else
+      http_response_body_fd(response, hit.fd, 0, hit.len, status_close_fd,
+                            (void *)(intptr_t)hit.fd);
+  } else {
+    return;
+  }
+  http_response_headerf(response, "ETag", "\"%s\"", hash);
+  http_response_header(response, "Cache-Control",
+                       "public, max-age=31536000, immutable");
+}
+
+static int status_server_handle(HttpRequest *request, HttpResponse *response,
+                                void *user_data) {
+  StatusServer *server = user_data;
+  if (request->method != HTTP_METHOD_GET &&
+      request->method != HTTP_METHOD_HEAD)
+    return 0;
+
+  if (http_request_path_is(request, "/events")) {
+    response->code = 200;
+    response->subscribe = 1;
+  } else if (http_request_path_is(request, "/now-playing")) {
+    pthread_mutex_lock(&server->lock);
+    StatusJson *json = server->latest;
+    if (json)
+      atomic_fetch_add(&json->refs, 1);
+    pthread_mutex_unlock(&server->lock);
+
+    if (!json) {
+      response->code = 503; // nothing polled yet
+      return 0;
+    }
+    response->code = 200;
+    response->content_type = "application/json";
+    http_response_header(response, "Cache-Control", "no-cache");
+    http_response_body(response, json->data, json->len, status_json_unref,
+                       json);
+  } else {
+    char hash[COVER_HASH_LENGTH + 1];
+    if (status_cover_path(request, hash))
+      status_serve_cover(server, request, response, hash);
+  }
+  return 0;
+}
+
+static void *status_server_main(void *arg) {
+  StatusServer *server = arg;
+  if (http_server_run(server->http) < 0)
+    perror("status server");
+  return NULL;
+}
+
+StatusServer *status_server_start(unsigned short port) {
+  StatusServer *server = calloc(1, sizeof(StatusServer));
+  if (!server)
+    return NULL;
+  pthread_mutex_init(&server->lock, NULL);
+  server->http = http_server_new(port, status_server_handle, server);
+  if (!server->http) {
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+    return NULL;
+  }
+  char *cover_dir = cover_cache_dir_default();
+  server->covers = cover_cache_new(cover_dir);
+  g_free(cover_dir);
+
+  int err = server->covers
+                ? pthread_create(&server->thread, NULL, status_server_main,
+                                 server)
+                : ENOMEM;
+  if (err) {
+    http_server_free(server->http);
+    cover_cache_free(server->covers);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+    errno = err;
+    return NULL;
+  }
+  return server;
+}
+
+void status_server_stop(StatusServer *server) {
+  http_server_stop(server->http);
+  pthread_join(server->thread, NULL);
+  http_server_free(server->http);
+  status_json_unref(server->latest);
+  cover_cache_free(server->covers);
+  pthread_mutex_destroy(&server->lock);
+  free(server);
+}
+
+static long status_elapsed_ms(const struct timespec *from,
+                              const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000 +
+         (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static int status_has_cover(const SpotifyCurrentlyPlaying *playing) {
+  return playing && playing->album_cover && playing->album_cover->jpeg;
+}
+
+static const char *status_cover_url(const SpotifyCurrentlyPlaying *playing) {
+  return status_has_cover(playing) && playing->album_cover->url
+             ? playing->album_cover->url
+             : "";
+}
+
+/** Whether `playing` differs from the last state pushed in a way that shows. */
+static int status_changed(const StatusServer *server,
+                          const SpotifyCurrentlyPlaying *playing) {
+  const char *id = playing && playing->id ? playing->id : "";
+  int is_playing = playing && playing->is_playing;
+  if (!server->published || strcmp(id, server->id) != 0 ||
+      is_playing != server->is_playing ||
+      strcmp(status_cover_url(playing), server->cover_url) != 0)
+    return 1;
+  if (!*id)
+    return 0;
+
+  long expected = server->progress_ms;
+  if (is_playing)
+    expected += status_elapsed_ms(&server->fetched_at, &playing->fetched_at);
+  return labs(playing->progress_ms - expected) > STATUS_SEEK_TOLERANCE_MS;
+}
+
+/** @param cover path the cover is served at, or NULL */
+static json_t *status_json(const SpotifyCurrentlyPlaying *playing,
+                           const char *cover) {
+  if (!playing || !playing->track_name)
+    return json_pack("{s:n, s:b}", "track", "is_playing", 0);
+
+  json_t *artists = json_array();
+  for (int i = 0; i < 3 && playing->artists[i]; i++)
+    json_array_append_new(artists, json_string(playing->artists[i]));
+
+  return json_pack("{s:s?, s:s, s:s?, s:o, s:s?, s:b, s:I, s:I}", "id",
+                   playing->id, "track", playing->track_name, "album",
+                   playing->album_name, "artists", artists, "cover", cover,
+                   "is_playing", playing->is_playing, "progress_ms",
+                   (json_int_t)playing->progress_ms, "duration_ms",
+                   (json_int_t)playing->duration_ms);
+}
+
+void status_server_publish(StatusServer *server,
+                           const SpotifyCurrentlyPlaying *playing) {
+  if (!status_changed(server, playing))
+    return;
+
+  // the exact bytes the poller fetched, so clients need not go to the CDN
+  char cover[sizeof(STATUS_COVER_PREFIX) + COVER_HASH_LENGTH +
+             sizeof(STATUS_COVER_SUFFIX)];
+  char hash[COVER_HASH_LENGTH + 1];
+  int has_cover = status_has_cover(playing) &&
+                  cover_cache_put(server->covers, playing->album_cover->jpeg,
+                                  playing->album_cover->jpeg_size, hash) == 0;
+  if (has_cover)
+    snprintf(cover, sizeof(cover), STATUS_COVER_PREFIX "%s" STATUS_COVER_SUFFIX,
+             hash);
+
+  json_t *event = status_json(playing, has_cover ? cover : NULL);
+  size_t len = json_dumpb(event, NULL, 0, JSON_COMPACT);
+  StatusJson *json = malloc(sizeof(StatusJson) + len);
+  if (!json) {
+    json_decref(event);
+    return;
+  }
+  atomic_init(&json->refs, 1);
+  json->len = json_dumpb(event, json->data, len, JSON_COMPACT);
+  json_decref(event);
+  http_server_broadcast(server->http, "now-playing", json->data, json->len);
+
+  pthread_mutex_lock(&server->lock);
+  StatusJson *old = server->latest;
+  server->latest = json;
+  pthread_mutex_unlock(&server->lock);
+  status_json_unref(old);
+
+  server->published = 1;
+  snprintf(server->id, sizeof(server->id), "%s",
+           playing && playing->id ? playing->id : "");
+  server->is_playing = playing && playing->is_playing;
+  snprintf(server->cover_url, sizeof(server->cover_url), "%s",
+           status_cover_url(playing));
+  if (playing) {
+    server->progress_ms = playing->progress_ms;
+    server->fetched_at = playing->fetched_at;
+  }
+}
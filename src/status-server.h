@@ -0,0 +1,47 @@
+/*
+
+Now-playing over HTTP, for status bars and dashboards.
+
+Runs the embedded HTTP server on its own thread and serves:
+
+  GET /events       text/event-stream of `now-playing` events, each a
+                    compact JSON object; the current state is sent on connect
+  GET /now-playing  the current state, the same JSON as the last event
+  GET /covers/<sha256>.jpg
+                    album art named by its `cover` field: the JPEG exactly as
+                    the poller downloaded it, with an ETag and cached for good
+
+Events are pushed as the poller fetches them, but only when something a
+subscriber could not have predicted changed: the track, play/pause, or a
+seek. Progress in between is left to the client to extrapolate from
+progress_ms and the time the event arrived.
+
+*/
+
+#ifndef __SNP_STATUS_SERVER_H__
+#define __SNP_STATUS_SERVER_H__
+
+#include "spotify.h"
+
+/** A seek is a progress jump of more than this against the clock. */
+#define STATUS_SEEK_TOLERANCE_MS 2000
+
+typedef struct StatusServer StatusServer;
+
+/**
+ * Start serving on `port` (all interfaces).
+ * @returns NULL on error (errno is set)
+ */
+StatusServer *status_server_start(unsigned short port);
+
+/** Stop the server thread and free everything. */
+void status_server_stop(StatusServer *server);
+
+/**
+ * Feed a poll result in; pushed to subscribers if it changed. Call from one
+ * thread only (the poller's).
+ */
+void status_server_publish(StatusServer *server,
+                           const SpotifyCurrentlyPlaying *playing);
+
+#endif /* __SNP_STATUS_SERVER_H__ */
@@ -1,17 +1,47 @@
 #include "term-util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+
+ChafaCanvasMode term_symbol_canvas_mode(ChafaTermInfo *term_info) {
+  if (chafa_term_info_have_seq(term_info,
+                               CHAFA_TERM_SEQ_SET_COLOR_FGBG_DIRECT) &&
+      chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_FG_DIRECT) &&
+      chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_BG_DIRECT))
+    return CHAFA_CANVAS_MODE_TRUECOLOR;
+  if (chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_FGBG_256) &&
+      chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_FG_256) &&
+      chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_BG_256))
+    return CHAFA_CANVAS_MODE_INDEXED_240;
+  if (chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_FGBG_16) &&
+      chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_FG_16) &&
+      chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_BG_16))
+    return CHAFA_CANVAS_MODE_INDEXED_16;
+  if (chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_INVERT_COLORS) &&
+      chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_RESET_ATTRIBUTES))
+    return CHAFA_CANVAS_MODE_FGBG_BGFG;
+  return CHAFA_CANVAS_MODE_FGBG;
+}
 
 void detect_terminal_mode(ChafaTermInfo **term_info_out,
                           ChafaCanvasMode *mode_out,
                           ChafaPixelMode *pixel_mode_out) {
+  gchar **envp = g_get_environ();
+  detect_terminal_mode_env(envp, term_info_out, mode_out, pixel_mode_out);
+  g_strfreev(envp);
+}
+
+void detect_terminal_mode_env(gchar **envp, ChafaTermInfo **term_info_out,
+                              ChafaCanvasMode *mode_out,
+                              ChafaPixelMode *pixel_mode_out) {
   ChafaCanvasMode mode;
   ChafaPixelMode pixel_mode;
   ChafaTermInfo *term_info;
 
-  gchar **envp;
-  envp = g_get_environ();
   term_info = chafa_term_db_detect(chafa_term_db_get_default(), envp);
-  g_strfreev(envp);
 
   // Determine what the best possible image quality setting is.
   if (chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_BEGIN_SIXELS)) {
@@ -27,36 +57,7 @@ void detect_terminal_mode(ChafaTermInfo **term_info_out,
     mode = CHAFA_CANVAS_MODE_TRUECOLOR;
   } else {
     pixel_mode = CHAFA_PIXEL_MODE_SYMBOLS;
-
-    if (chafa_term_info_have_seq(term_info,
-                                 CHAFA_TERM_SEQ_SET_COLOR_FGBG_DIRECT) &&
-        chafa_term_info_have_seq(term_info,
-                                 CHAFA_TERM_SEQ_SET_COLOR_FG_DIRECT) &&
-        chafa_term_info_have_seq(term_info, CHAFA_TERM_SEQ_SET_COLOR_BG_DIRECT))
-      mode = CHAFA_CANVAS_MODE_TRUECOLOR;
-    else if (chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_SET_COLOR_FGBG_256) &&
-             chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_SET_COLOR_FG_256) &&
-             chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_SET_COLOR_BG_256)
-
-    )
-      mode = CHAFA_CANVAS_MODE_INDEXED_240;
-    else if (chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_SET_COLOR_FGBG_16) &&
-             chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_SET_COLOR_FG_16) &&
-             chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_SET_COLOR_BG_16))
-      mode = CHAFA_CANVAS_MODE_INDEXED_16;
-    else if (chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_INVERT_COLORS) &&
-             chafa_term_info_have_seq(term_info,
-                                      CHAFA_TERM_SEQ_RESET_ATTRIBUTES))
-      mode = CHAFA_CANVAS_MODE_FGBG_BGFG;
-    else
-      mode = CHAFA_CANVAS_MODE_FGBG;
+    mode = term_symbol_canvas_mode(term_info);
   }
 
   *term_info_out = term_info;
@@ -64,6 +65,24 @@ void detect_terminal_mode(ChafaTermInfo **term_info_out,
   *pixel_mode_out = pixel_mode;
 }
 
+gboolean term_supports_sync_output(ChafaTermInfo *term_info, gchar **envp) {
+  // Querying with DECRQM would need a raw-mode round trip through the tty, so
+  // go by the terminals known to implement it instead.
+  static const char *known[] = {"kitty",     "foot",  "wezterm", "contour",
+                                "alacritty", "iterm", "ghostty", NULL};
+
+  const char *name = chafa_term_info_get_name(term_info);
+  const char *program = g_environ_getenv(envp, "TERM_PROGRAM");
+  for (int i = 0; known[i]; i++) {
+    if (name && g_ascii_strncasecmp(name, known[i], strlen(known[i])) == 0)
+      return TRUE;
+    if (program &&
+        g_ascii_strncasecmp(program, known[i], strlen(known[i])) == 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
 TermSize get_tty_size() {
   TermSize term_size;
   term_size.width_cells = term_size.height_cells = term_size.width_pixels =
@@ -104,7 +123,10 @@ inline void term_rel_cursor(int x, int y) {
 }
 
 struct term_dimensions get_term_dimensions() {
-  TermSize term_size = get_tty_size();
+  return term_dimensions_from_size(get_tty_size());
+}
+
+struct term_dimensions term_dimensions_from_size(TermSize term_size) {
   struct term_dimensions out = {.h_cell = term_size.height_cells,
                                 .w_cell = term_size.width_cells,
                                 .w_px = term_size.width_pixels,
@@ -122,6 +144,54 @@ struct term_dimensions get_term_dimensions() {
   return out;
 }
 
+static int resize_pipe[2] = {-1, -1};
+
+static void term_on_sigwinch(int sig) {
+  (void)sig;
+  int saved_errno = errno;
+  // a full pipe already has a wakeup queued, so a failed write is fine
+  (void)!write(resize_pipe[1], "", 1);
+  errno = saved_errno;
+}
+
+int term_resize_watch(void) {
+  if (resize_pipe[0] >= 0)
+    return resize_pipe[0];
+
+  if (pipe(resize_pipe) == -1) {
+    perror("pipe");
+    return -1;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(resize_pipe[i], F_SETFL, fcntl(resize_pipe[i], F_GETFL) | O_NONBLOCK);
+    fcntl(resize_pipe[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  struct sigaction sa = {0};
+  sa.sa_handler = term_on_sigwinch;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGWINCH, &sa, NULL) == -1) {
+    perror("sigaction(SIGWINCH)");
+    return -1;
+  }
+  return resize_pipe[0];
+}
+
+int term_resize_wait(int fd, int timeout_ms) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  int n = poll(&pfd, 1, timeout_ms);
+  if (n < 0 && errno != EINTR)
+    return 0;
+
+  // drain everything queued so a burst of resizes costs one re-layout
+  char drain[64];
+  int resized = 0;
+  while (read(fd, drain, sizeof(drain)) > 0)
+    resized = 1;
+  return resized;
+}
+
 // void term_print_image(unsigned char *buffer, int width, int height, int
 // stride,
 //                       int t_width, int t_height) {
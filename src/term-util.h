@@ -10,14 +10,31 @@ typedef struct {
   gint width_pixels, height_pixels;
 } TermSize;
 
+/** Best colour mode for symbol output; used when pixel modes aren't. */
+ChafaCanvasMode term_symbol_canvas_mode(ChafaTermInfo *term_info);
+
 void detect_terminal_mode(ChafaTermInfo **term_info_out,
                           ChafaCanvasMode *mode_out,
                           ChafaPixelMode *pixel_mode_out);
+/** Same, for a terminal described by `envp` rather than our own. */
+void detect_terminal_mode_env(gchar **envp, ChafaTermInfo **term_info_out,
+                              ChafaCanvasMode *mode_out,
+                              ChafaPixelMode *pixel_mode_out);
 
 TermSize get_tty_size();
 
+/**
+ * Whether the terminal understands synchronized output (DEC private mode
+ * 2026), i.e. holds off repainting between TERM_SYNC_BEGIN and TERM_SYNC_END.
+ * `envp` is the environment the terminal was detected from.
+ */
+gboolean term_supports_sync_output(ChafaTermInfo *term_info, gchar **envp);
+
 #define TERM_ESC "\033"
 #define TERM_CURSOR_RESTORE TERM_ESC "8"
+#define TERM_ERASE_LINE_RIGHT TERM_ESC "[K"
+#define TERM_SYNC_BEGIN TERM_ESC "[?2026h"
+#define TERM_SYNC_END TERM_ESC "[?2026l"
 #define term_c_bold(str) TERM_ESC "[1m" str TERM_ESC "[22m"
 #define term_c_dim(str) TERM_ESC "[2m" str TERM_ESC "[22m"
 #define term_c_ital(str) TERM_ESC "[3m" str TERM_ESC "[23m"
@@ -42,5 +59,20 @@ struct term_dimensions {
   float font_ratio;
 };
 struct term_dimensions get_term_dimensions();
+struct term_dimensions term_dimensions_from_size(TermSize term_size);
+
+/**
+ * Start watching for terminal resizes. SIGWINCH is forwarded through a
+ * self-pipe so it can be waited on alongside everything else.
+ * @returns fd that becomes readable on resize, or -1 on error
+ */
+int term_resize_watch(void);
+
+/**
+ * Wait up to `timeout_ms` for a resize on the fd from term_resize_watch.
+ * Any burst of pending SIGWINCHs is consumed as one.
+ * @returns 1 if the terminal was resized, 0 on timeout
+ */
+int term_resize_wait(int fd, int timeout_ms);
 
 #endif /* __SNP_TERM_UTIL_H__ */
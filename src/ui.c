@@ -0,0 +1,550 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc-stats.h"
+#include "halfblock.h"
+#include "kitty.h"
+#include "scale.h"
+#include "sgr.h"
+#include "ui.h"
+
+void ui_terminal_detect(UiTerminal *term, gchar **envp, TermSize size) {
+  detect_terminal_mode_env(envp, &term->term_info, &term->canvas_mode,
+                           &term->pixel_mode);
+  term->sync_output = term_supports_sync_output(term->term_info, envp);
+  term->dim = term_dimensions_from_size(size);
+}
+
+void ui_init(struct ui_ctx *ctx, UiTerminal *term) {
+  ctx->term_info = term->term_info;
+  ctx->canvas_mode = term->canvas_mode;
+  ctx->pixel_mode = term->pixel_mode;
+  ctx->sync_output = term->sync_output;
+  ctx->dim = term->dim;
+  ctx->symbol_map = chafa_symbol_map_new();
+  chafa_symbol_map_add_by_tags(ctx->symbol_map, CHAFA_SYMBOL_TAG_ASCII);
+  ctx->symbol_canvas_mode = term_symbol_canvas_mode(ctx->term_info);
+  ctx->link_rate = 0;
+  ctx->link_rate_at = 0;
+  ctx->layout_src_w = ctx->layout_src_h = 0;
+  ctx->config = NULL;
+  ctx->canvas = NULL;
+  ctx->scaled_url[0] = 0;
+  ctx->scaled_w = ctx->scaled_h = 0;
+  ctx->scaled = NULL;
+  ctx->cover_want_w = ctx->cover_want_h = 0;
+  ctx->paint_track[0] = 0;
+  ctx->kitty_id = 0;
+  ctx->kitty_shm = FALSE;
+
+  memset(ctx->cover_cache, 0, sizeof(ctx->cover_cache));
+  ctx->cover_gen = ctx->cover_clock = 0;
+  screen_init(&ctx->screen);
+  ctx->out_fd = -1;
+  frame_init(&ctx->frame);
+  frame_init(&ctx->scratch);
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+void ui_setup(struct ui_ctx *ctx) {
+  UiTerminal term;
+  gchar **envp = g_get_environ();
+  ui_terminal_detect(&term, envp, get_tty_size());
+  g_strfreev(envp);
+
+  ui_init(ctx, &term);
+  ctx->out_fd = STDOUT_FILENO;
+  ctx->kitty_shm = kitty_is_local();
+
+  char *p = frame_reserve(&ctx->frame, CHAFA_TERM_SEQ_LENGTH_MAX * 2);
+  p = chafa_term_info_emit_clear(ctx->term_info, p);
+  p = chafa_term_info_emit_cursor_to_top_left(ctx->term_info, p);
+  frame_commit(&ctx->frame, p);
+  fflush(stdout);
+  frame_flush(&ctx->frame, ctx->out_fd);
+}
+
+void ui_teardown(struct ui_ctx *ctx) {
+  if (ctx->kitty_id && ctx->out_fd >= 0) {
+    char *p = frame_reserve(&ctx->frame, KITTY_SEQ_LENGTH_MAX);
+    frame_commit(&ctx->frame, kitty_emit_delete(p, ctx->kitty_id));
+    frame_flush(&ctx->frame, ctx->out_fd);
+    kitty_shm_release(ctx->kitty_id);
+  }
+  for (int i = 0; i < UI_COVER_CACHE_SIZE; i++)
+    if (ctx->cover_cache[i].out)
+      g_string_free(ctx->cover_cache[i].out, TRUE);
+  if (ctx->canvas)
+    chafa_canvas_unref(ctx->canvas);
+  if (ctx->config)
+    chafa_canvas_config_unref(ctx->config);
+  free(ctx->scaled);
+  frame_free(&ctx->frame);
+  frame_free(&ctx->scratch);
+  chafa_term_info_unref(ctx->term_info);
+  chafa_symbol_map_unref(ctx->symbol_map);
+}
+
+/** The long-lived canvas, rebuilt only if the geometry or modes changed. */
+static ChafaCanvas *ui_canvas_get(struct ui_ctx *ctx, const UiCanvasKey *key) {
+  if (ctx->canvas && memcmp(key, &ctx->canvas_key, sizeof(*key)) == 0)
+    return ctx->canvas;
+
+  if (ctx->canvas)
+    chafa_canvas_unref(ctx->canvas);
+  if (ctx->config)
+    chafa_canvas_config_unref(ctx->config);
+
+  ctx->config = chafa_canvas_config_new();
+  chafa_canvas_config_set_symbol_map(ctx->config, ctx->symbol_map);
+  chafa_canvas_config_set_canvas_mode(ctx->config, key->canvas_mode);
+  chafa_canvas_config_set_pixel_mode(ctx->config, key->pixel_mode);
+  chafa_canvas_config_set_geometry(ctx->config, key->width_cells,
+                                   key->height_cells);
+  if (key->cell_width > 0 && key->cell_height > 0)
+    chafa_canvas_config_set_cell_geometry(ctx->config, key->cell_width,
+                                          key->cell_height);
+
+  ctx->canvas = chafa_canvas_new(ctx->config);
+  ctx->canvas_key = *key;
+  return ctx->canvas;
+}
+
+/**
+ * The cover shrunk to w x h pixels. Falls back to the original pixels when
+ * that size is unknown or larger; check *w_out / *h_out for what was used.
+ */
+static const guint8 *ui_cover_scaled(struct ui_ctx *ctx,
+                                     SpotifyAlbumCover *cover, int w, int h,
+                                     int *w_out, int *h_out) {
+  *w_out = cover->width;
+  *h_out = cover->height;
+  ctx->cover_want_w = w;
+  ctx->cover_want_h = h;
+  if (w <= 0 || h <= 0 || w > cover->width || h > cover->height)
+    return cover->pixels;
+
+  if (cover->scaled && w == cover->scaled_width && h == cover->scaled_height) {
+    *w_out = w;
+    *h_out = h;
+    return cover->scaled; // shrunk ahead of time, off this thread
+  }
+  if (!ctx->scaled || !cover->url || w != ctx->scaled_w ||
+      h != ctx->scaled_h || strcmp(cover->url, ctx->scaled_url) != 0) {
+    guint8 *scaled = realloc(ctx->scaled, (size_t)w * h * 3);
+    if (!scaled)
+      return cover->pixels;
+    ctx->scaled = scaled;
+    ctx->scaled_url[0] = 0; // invalid until the scale succeeds
+    if (scale_rgb_box(cover->pixels, cover->width, cover->height,
+                      cover->width * 3, scaled, w, h) != 0)
+      return cover->pixels;
+
+    snprintf(ctx->scaled_url, sizeof(ctx->scaled_url), "%s",
+             cover->url ? cover->url : "");
+    ctx->scaled_w = w;
+    ctx->scaled_h = h;
+  }
+
+  *w_out = w;
+  *h_out = h;
+  return ctx->scaled;
+}
+
+/** Run the cover through chafa. Caller owns the returned string. */
+static GString *ui_cover_print(struct ui_ctx *ctx, SpotifyAlbumCover *cover,
+                               const UiCoverKey *key) {
+  // the pixel size chafa will sample at: cells times the cell size in pixel
+  // modes, or cells times the 8x8 symbol resolution otherwise
+  const UiCanvasKey *c = &key->canvas;
+  int w, h;
+  const guint8 *pixels =
+      c->pixel_mode == CHAFA_PIXEL_MODE_SYMBOLS
+          ? ui_cover_scaled(ctx, cover, c->width_cells * 8,
+                            c->height_cells * 8, &w, &h)
+          : ui_cover_scaled(ctx, cover, c->width_cells * c->cell_width,
+                            c->height_cells * c->cell_height, &w, &h);
+
+  ChafaCanvas *canvas = ui_canvas_get(ctx, &key->canvas);
+  chafa_canvas_draw_all_pixels(canvas, CHAFA_PIXEL_RGB8, pixels, w, h, w * 3);
+  return chafa_canvas_print(canvas, ctx->term_info);
+}
+
+/** Whether the half-block renderer can stand in for chafa with `key`. */
+static gboolean ui_halfblock_usable(const struct ui_ctx *ctx,
+                                    const UiCanvasKey *key) {
+  return ctx->renderer == UI_RENDERER_HALFBLOCK &&
+         key->pixel_mode == CHAFA_PIXEL_MODE_SYMBOLS &&
+         (key->canvas_mode == CHAFA_CANVAS_MODE_TRUECOLOR ||
+          key->canvas_mode == CHAFA_CANVAS_MODE_INDEXED_240);
+}
+
+/**
+ * Half-block fast path: two pixels per cell, so the cover only needs
+ * averaging down to cells x 2 rows. Returns NULL if it can't be shrunk that
+ * far (tiny covers), leaving those to chafa.
+ */
+static GString *ui_cover_halfblock(struct ui_ctx *ctx,
+                                   SpotifyAlbumCover *cover,
+                                   const UiCoverKey *key) {
+  int w = key->canvas.width_cells, h = key->canvas.height_cells * 2;
+  int sw, sh;
+  const guint8 *pixels = ui_cover_scaled(ctx, cover, w, h, &sw, &sh);
+  if (sw != w || sh != h)
+    return NULL;
+
+  frame_reset(&ctx->scratch);
+  halfblock_render(&ctx->scratch, pixels, w, h, w * 3,
+                   key->canvas.canvas_mode == CHAFA_CANVAS_MODE_TRUECOLOR
+                       ? HALFBLOCK_TRUECOLOR
+                       : HALFBLOCK_240);
+  return g_string_new_len(ctx->scratch.data, ctx->scratch.len);
+}
+
+/** Kitty mode: delete the stored cover, and with it its placement. */
+static void ui_kitty_forget(struct ui_ctx *ctx) {
+  if (!ctx->kitty_id)
+    return;
+  char buf[KITTY_SEQ_LENGTH_MAX];
+  char *p = kitty_emit_delete(buf, ctx->kitty_id);
+  frame_append(&ctx->frame, buf, p - buf);
+  kitty_shm_release(ctx->kitty_id);
+  ctx->kitty_id = 0;
+}
+
+/**
+ * Kitty mode: make sure the terminal holds the cover, uploading it straight
+ * into the frame being built if not. Only one cover is kept stored.
+ */
+static void ui_kitty_upload(struct ui_ctx *ctx, SpotifyAlbumCover *cover) {
+  guint32 id = kitty_image_id(cover->url);
+
+  if (id != ctx->kitty_id || !cover->url) {
+    if (ctx->kitty_id != id)
+      ui_kitty_forget(ctx);
+    // shared memory skips the pty entirely; inline base64 works anywhere
+    if (!ctx->kitty_shm ||
+        kitty_upload_rgb_shm(&ctx->frame, id, cover->pixels, cover->width,
+                             cover->height) != 0)
+      kitty_upload_rgb(&ctx->frame, id, cover->pixels, cover->width,
+                       cover->height);
+    ctx->kitty_id = id;
+  }
+}
+
+/** Kitty mode: the cached output is just a placement of the stored image. */
+static GString *ui_cover_kitty(struct ui_ctx *ctx, SpotifyAlbumCover *cover,
+                               const UiCoverKey *key) {
+  char buf[KITTY_SEQ_LENGTH_MAX];
+  char *p = kitty_emit_place(buf, kitty_image_id(cover->url),
+                             key->canvas.width_cells,
+                             key->canvas.height_cells);
+  return g_string_new_len(buf, p - buf);
+}
+
+void ui_resize(struct ui_ctx *ctx) {
+  ctx->dim = get_term_dimensions();
+  ctx->layout_src_w = ctx->layout_src_h = 0;
+  screen_init(&ctx->screen);
+}
+
+void ui_invalidate(struct ui_ctx *ctx) {
+  screen_init(&ctx->screen);
+  ctx->kitty_id = 0;
+}
+
+/** Size of the cover in cells, recomputed only on resize or new dimensions */
+static void ui_layout(struct ui_ctx *ctx, SpotifyAlbumCover *cover) {
+  if (cover->width == ctx->layout_src_w && cover->height == ctx->layout_src_h)
+    return;
+
+  ctx->layout_w_cells = 14;
+  ctx->layout_h_cells = 7;
+  chafa_calc_canvas_geometry(cover->width, cover->height, &ctx->layout_w_cells,
+                             &ctx->layout_h_cells, ctx->dim.font_ratio, FALSE,
+                             FALSE);
+  ctx->layout_src_w = cover->width;
+  ctx->layout_src_h = cover->height;
+}
+
+static UiCoverCacheEntry *ui_cover_cache_lookup(struct ui_ctx *ctx,
+                                                const UiCoverKey *key) {
+  for (int i = 0; i < UI_COVER_CACHE_SIZE; i++) {
+    UiCoverCacheEntry *e = &ctx->cover_cache[i];
+    if (e->out && memcmp(&e->key, key, sizeof(*key)) == 0) {
+      e->last_used = ++ctx->cover_clock;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/** Store `out` under `key`, evicting the least recently used entry. */
+static UiCoverCacheEntry *ui_cover_cache_insert(struct ui_ctx *ctx,
+                                                const UiCoverKey *key,
+                                                GString *out) {
+  UiCoverCacheEntry *victim = &ctx->cover_cache[0];
+  for (int i = 0; i < UI_COVER_CACHE_SIZE; i++) {
+    UiCoverCacheEntry *e = &ctx->cover_cache[i];
+    if (!e->out) {
+      victim = e;
+      break;
+    }
+    if (e->last_used < victim->last_used)
+      victim = e;
+  }
+
+  if (victim->out)
+    g_string_free(victim->out, TRUE);
+  victim->key = *key;
+  victim->out = out;
+  victim->gen = ++ctx->cover_gen;
+  victim->last_used = ++ctx->cover_clock;
+  return victim;
+}
+
+/** Symbol output with only the colour changes each cell needs. */
+static GString *ui_cover_reencode(struct ui_ctx *ctx, GString *out) {
+  frame_reset(&ctx->scratch);
+  sgr_reencode(&ctx->scratch, out->str, out->len);
+  g_string_truncate(out, 0);
+  g_string_append_len(out, ctx->scratch.data, ctx->scratch.len);
+  return out;
+}
+
+/** Look `key` up in the cache, printing the cover into it on a miss. */
+static UiCoverCacheEntry *ui_cover_render(struct ui_ctx *ctx,
+                                          SpotifyAlbumCover *cover,
+                                          const UiCoverKey *key) {
+  if (key->canvas.pixel_mode == CHAFA_PIXEL_MODE_KITTY)
+    ui_kitty_upload(ctx, cover);
+
+  // covers without a url have no identity to key on, so always redraw them
+  UiCoverCacheEntry *e;
+  if (cover->url && (e = ui_cover_cache_lookup(ctx, key)))
+    return e;
+
+  GString *out = NULL;
+  if (key->canvas.pixel_mode == CHAFA_PIXEL_MODE_KITTY)
+    out = ui_cover_kitty(ctx, cover, key);
+  else if (ui_halfblock_usable(ctx, &key->canvas))
+    out = ui_cover_halfblock(ctx, cover, key);
+  if (!out)
+    out = ui_cover_print(ctx, cover, key);
+  if (key->canvas.pixel_mode == CHAFA_PIXEL_MODE_SYMBOLS)
+    out = ui_cover_reencode(ctx, out);
+  return ui_cover_cache_insert(ctx, key, out);
+}
+
+/** Bytes per second output may use right now; 0 for unlimited. */
+static long ui_output_rate(struct ui_ctx *ctx) {
+  if (ctx->max_rate <= 0)
+    return 0;
+  if (ctx->link_rate &&
+      g_get_monotonic_time() - ctx->link_rate_at > UI_LINK_FORGET_US)
+    ctx->link_rate = 0; // the link may have recovered; find out again
+  return ctx->link_rate ? MIN(ctx->max_rate, ctx->link_rate) : ctx->max_rate;
+}
+
+/** Record how fast a frame went out, if writing it had to wait. */
+static void ui_link_measure(struct ui_ctx *ctx, size_t bytes, gint64 us) {
+  if (us < UI_LINK_BLOCKED_US)
+    return;
+  long sample = (long)(bytes * G_USEC_PER_SEC / us);
+  ctx->link_rate = ctx->link_rate ? (ctx->link_rate * 3 + sample) / 4 : sample;
+  ctx->link_rate_at = g_get_monotonic_time();
+}
+
+/** Apply fidelity `level` on top of what the terminal supports. */
+static void ui_fidelity(const struct ui_ctx *ctx, int level, UiCanvasKey *key) {
+  if (level >= 1 && key->pixel_mode != CHAFA_PIXEL_MODE_SYMBOLS) {
+    key->pixel_mode = CHAFA_PIXEL_MODE_SYMBOLS;
+    key->canvas_mode = ctx->symbol_canvas_mode;
+  }
+  if (level >= 2 && key->canvas_mode == CHAFA_CANVAS_MODE_TRUECOLOR)
+    key->canvas_mode = CHAFA_CANVAS_MODE_INDEXED_240;
+  if (level >= 3 && key->canvas_mode == CHAFA_CANVAS_MODE_INDEXED_240)
+    key->canvas_mode = CHAFA_CANVAS_MODE_INDEXED_16;
+  if (level >= 4) {
+    key->width_cells = MAX(1, key->width_cells / 2);
+    key->height_cells = MAX(1, key->height_cells / 2);
+  }
+}
+
+/**
+ * Printed cover for the current geometry. Only calls into chafa when this
+ * cover has not been printed at this geometry and mode recently. Under an
+ * output budget, steps down in fidelity until the cover fits in it.
+ */
+static UiCoverCacheEntry *ui_cover_get(struct ui_ctx *ctx,
+                                       SpotifyAlbumCover *cover) {
+  ui_layout(ctx, cover);
+
+  UiCoverKey key;
+  memset(&key, 0, sizeof(key)); // padding takes part in memcmp
+  if (cover->url)
+    snprintf(key.cover_url, sizeof(key.cover_url), "%s", cover->url);
+  UiCanvasKey full = {
+      .width_cells = ctx->layout_w_cells,
+      .height_cells = ctx->layout_h_cells,
+      .cell_width = ctx->dim.cw_px,
+      .cell_height = ctx->dim.ch_px,
+      .canvas_mode = ctx->canvas_mode,
+      .pixel_mode = ctx->pixel_mode,
+  };
+
+  long rate = ui_output_rate(ctx);
+  for (int level = 0;; level++) {
+    key.canvas = full;
+    ui_fidelity(ctx, level, &key.canvas);
+    gboolean last = rate == 0 || level == UI_FIDELITY_LEVELS - 1;
+
+    // a kitty upload goes out as it is prepared, so judge it beforehand
+    if (!last && key.canvas.pixel_mode == CHAFA_PIXEL_MODE_KITTY &&
+        !ctx->kitty_shm && kitty_image_id(cover->url) != ctx->kitty_id &&
+        (long)cover->width * cover->height * 4 > rate)
+      continue;
+
+    UiCoverCacheEntry *e = ui_cover_render(ctx, cover, &key);
+    if (last || (long)e->out->len <= rate) {
+      // the previous cover's image would stay on top of a symbol cover
+      if (key.canvas.pixel_mode != CHAFA_PIXEL_MODE_KITTY)
+        ui_kitty_forget(ctx);
+      ctx->stats.fidelity = level;
+      return e;
+    }
+  }
+}
+
+/** Playback position now, extrapolated from the snapshot's. */
+static long ui_progress_ms(const SpotifyCurrentlyPlaying *playing) {
+  long ms = playing->progress_ms;
+  if (playing->is_playing) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms += (now.tv_sec - playing->fetched_at.tv_sec) * 1000 +
+          (now.tv_nsec - playing->fetched_at.tv_nsec) / 1000000;
+  }
+  return CLAMP(ms, 0, playing->duration_ms);
+}
+
+static void ui_progress(struct ui_ctx *ctx, Screen *next,
+                        const SpotifyCurrentlyPlaying *playing) {
+  if (playing->duration_ms <= 0)
+    return;
+
+  long progress_ms = ui_progress_ms(playing);
+  long elapsed = progress_ms / 1000;
+  long remaining = playing->duration_ms / 1000 - elapsed;
+  int width = ctx->dim.w_cell > 0 ? CLAMP(ctx->dim.w_cell - 18, 10, 60) : 30;
+
+  screen_bar(next, 17, 6, width,
+             (int)((long long)progress_ms * width * 8 / playing->duration_ms));
+  screen_text(next, 17, 7, SGR_DIM, "%ld:%02ld  -%ld:%02ld", elapsed / 60,
+              elapsed % 60, remaining / 60, remaining % 60);
+}
+
+/**
+ * Note how long after its poll response `playing` made it on screen, for
+ * the first and for the final stage of a track change.
+ */
+static void ui_paint_timing(struct ui_ctx *ctx,
+                            const SpotifyCurrentlyPlaying *playing) {
+  if (!playing || !playing->id)
+    return;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long ms = (now.tv_sec - playing->fetched_at.tv_sec) * 1000 +
+            (now.tv_nsec - playing->fetched_at.tv_nsec) / 1000000;
+
+  if (strcmp(playing->id, ctx->paint_track) != 0) {
+    snprintf(ctx->paint_track, sizeof(ctx->paint_track), "%s", playing->id);
+    ctx->stats.first_paint_ms = ms;
+    ctx->stats.final_paint_ms = -1;
+  }
+  const SpotifyAlbumCover *cover = playing->album_cover;
+  if (ctx->stats.final_paint_ms < 0 &&
+      (!playing->cover_url || (cover && cover->url &&
+                               strcmp(cover->url, playing->cover_url) == 0)))
+    ctx->stats.final_paint_ms = ms;
+}
+
+void ui_compose(struct ui_ctx *ctx, SpotifyCurrentlyPlaying *playing) {
+  // the frame is started first: fetching the cover may already add to it
+  FrameBuffer *frame = &ctx->frame;
+  frame_reset(frame);
+  if (ctx->sync_output)
+    frame_append_lit(frame, TERM_SYNC_BEGIN);
+  size_t frame_start = frame->len;
+
+  Screen next;
+  screen_init(&next);
+
+  if (playing && playing->track_name) {
+    screen_text(&next, 17, 1, SGR_BOLD, "%s", playing->track_name);
+    screen_text(&next, 17, 2, SGR_DIM, "%s", playing->album_name);
+    screen_text(&next, 17, 5, 0, "%s", playing->artists[0]);
+    ui_progress(ctx, &next, playing);
+  } else {
+    screen_text(&next, 17, 1, SGR_DIM, "%s",
+                playing ? "Nothing is playing" : "Waiting for Spotify...");
+  }
+
+  if (playing && playing->album_cover) {
+    UiCoverCacheEntry *cover = ui_cover_get(ctx, playing->album_cover);
+    screen_image(&next, cover->out, cover->gen,
+                 cover->key.canvas.width_cells,
+                 cover->key.canvas.height_cells);
+  }
+
+  screen_present(&ctx->screen, &next, ctx->term_info, frame);
+  ui_paint_timing(ctx, playing);
+  if (frame->len == frame_start)
+    frame_reset(frame); // nothing changed, not even the sync markers are sent
+  else if (ctx->sync_output)
+    frame_append_lit(frame, TERM_SYNC_END);
+}
+
+int ui_render(struct ui_ctx *ctx, SpotifyCurrentlyPlaying *playing) {
+  unsigned long allocs = alloc_stats_count();
+  int ret = 0;
+  FrameBuffer *frame = &ctx->frame;
+  ui_compose(ctx, playing);
+
+  size_t frame_len = frame->len;
+  fflush(stdout); // anything printed outside the frame must land before it
+  gint64 write_start = g_get_monotonic_time();
+  if (frame_flush(frame, ctx->out_fd) != 0) {
+    if (errno == EPIPE)
+      ret = -1; // nobody is reading any more
+    else
+      perror("write");
+  }
+  ui_link_measure(ctx, frame_len, g_get_monotonic_time() - write_start);
+
+  ctx->stats.frames++;
+  ctx->stats.frame_bytes = frame_len;
+  ctx->stats.frame_syscalls = frame->flush_syscalls;
+  ctx->stats.frame_allocs = alloc_stats_count() - allocs;
+  ctx->stats.total_bytes += frame_len;
+  return ret;
+}
+
+void ui_stats_print(struct ui_ctx *ctx, FILE *out) {
+  fprintf(out, "frame %lu: %zu bytes in %lu writes (%zu total)",
+          ctx->stats.frames, ctx->stats.frame_bytes, ctx->stats.frame_syscalls,
+          ctx->stats.total_bytes);
+  if (alloc_stats_enabled())
+    fprintf(out, ", %lu allocs", ctx->stats.frame_allocs);
+  if (ctx->max_rate > 0)
+    fprintf(out, ", fidelity %d, link %ld B/s", ctx->stats.fidelity,
+            ctx->link_rate);
+  if (ctx->paint_track[0])
+    fprintf(out, ", track painted in %ld ms (final %ld ms)",
+            ctx->stats.first_paint_ms, ctx->stats.final_paint_ms);
+  fputc('\n', out);
+}
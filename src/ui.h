@@ -0,0 +1,192 @@
+#ifndef __SNP_UI_H__
+#define __SNP_UI_H__
+
+#include <chafa.h>
+
+#include "frame.h"
+#include "screen.h"
+#include "spotify.h"
+#include "term-util.h"
+
+/**
+ * A terminal to draw for: detected from our own environment and tty, or from
+ * what a daemon client reported about its own.
+ */
+typedef struct {
+  ChafaTermInfo *term_info;
+  ChafaCanvasMode canvas_mode;
+  ChafaPixelMode pixel_mode;
+  gboolean sync_output;
+  struct term_dimensions dim;
+} UiTerminal;
+
+/** Detect the terminal described by `envp` and `size`. */
+void ui_terminal_detect(UiTerminal *term, gchar **envp, TermSize size);
+
+/** Everything a chafa canvas is configured with. Compared with memcmp. */
+typedef struct {
+  gint width_cells, height_cells;
+  gint cell_width, cell_height;
+  ChafaCanvasMode canvas_mode;
+  ChafaPixelMode pixel_mode;
+} UiCanvasKey;
+
+/**
+ * Everything that determines the bytes chafa prints for a cover. Two equal
+ * keys (compared with memcmp) always produce identical output.
+ */
+typedef struct {
+  char cover_url[256];
+  UiCanvasKey canvas;
+} UiCoverKey;
+
+/** What turns cover pixels into terminal output in symbol modes. */
+typedef enum {
+  UI_RENDERER_CHAFA,
+  /** Native half blocks; truecolor and 240-colour canvases only. */
+  UI_RENDERER_HALFBLOCK,
+} UiRenderer;
+
+/** Covers printed at distinct sizes/modes kept around for reuse. */
+#define UI_COVER_CACHE_SIZE 8
+
+typedef struct {
+  UiCoverKey key;
+  /** Printed output; NULL for an empty slot. */
+  GString *out;
+  /** Unique per rendering, so the screen can tell outputs apart. */
+  unsigned long gen;
+  unsigned long last_used;
+} UiCoverCacheEntry;
+
+/**
+ * Steps taken, in order, to make covers cheaper when the output budget is
+ * tight: symbols instead of pixel graphics, 240 colours, 16 colours, then half
+ * the size. Level 0 is what the terminal supports.
+ */
+#define UI_FIDELITY_LEVELS 5
+/** write(2) taking this long means the pty was full: the link is the limit */
+#define UI_LINK_BLOCKED_US 10000
+/** Measured throughput is forgotten after this long without a full pty. */
+#define UI_LINK_FORGET_US (30 * G_USEC_PER_SEC)
+
+/** Output counters, for checking how much a frame actually costs. */
+struct ui_stats {
+  unsigned long frames;
+  size_t frame_bytes;
+  unsigned long frame_syscalls;
+  /** Heap allocations made while rendering; see alloc-stats.h. */
+  unsigned long frame_allocs;
+  size_t total_bytes;
+  /** Fidelity level of the cover on screen (0 is full). */
+  int fidelity;
+  /**
+   * For the latest track change: ms from reading its poll response to the
+   * first frame showing it, and to the first showing its full cover (-1
+   * until then).
+   */
+  long first_paint_ms, final_paint_ms;
+};
+
+struct ui_ctx {
+  ChafaTermInfo *term_info;
+  ChafaPixelMode pixel_mode;
+  ChafaCanvasMode canvas_mode;
+  ChafaSymbolMap *symbol_map;
+  gboolean sync_output;
+  /** Chosen by the caller; applies wherever the renderer supports the mode */
+  UiRenderer renderer;
+  /** Colour mode for symbols, when pixel modes are dropped for bandwidth. */
+  ChafaCanvasMode symbol_canvas_mode;
+
+  /**
+   * Output budget in bytes per second, set by the caller (0 for none). A
+   * new cover has to fit in one second of it, or in one second of the
+   * measured link throughput if that is lower, else fidelity is lowered.
+   */
+  long max_rate;
+  /** Throughput seen while writes were blocking, bytes/s; 0 if unknown. */
+  long link_rate;
+  gint64 link_rate_at;
+
+  /** Terminal geometry; only re-read by ui_resize. */
+  struct term_dimensions dim;
+  /** Cover layout in cells, valid for covers of layout_src_w x layout_src_h */
+  gint layout_src_w, layout_src_h;
+  gint layout_w_cells, layout_h_cells;
+
+  /** Canvas kept across frames; rebuilt only when canvas_key changes. */
+  UiCanvasKey canvas_key;
+  ChafaCanvasConfig *config;
+  ChafaCanvas *canvas;
+
+  /**
+   * The cover shrunk to the exact pixel size of the canvas, so chafa only
+   * sees pixels it will use. Keyed on cover url and size.
+   */
+  char scaled_url[256];
+  gint scaled_w, scaled_h;
+  guint8 *scaled;
+  /**
+   * Pixel size the last cover was wanted at, for covers to be shrunk to
+   * ahead of time (see SpotifyAlbumCover.scaled); 0 when drawn unscaled.
+   */
+  gint cover_want_w, cover_want_h;
+
+  /** In kitty mode, the image id the current cover is stored under (or 0). */
+  guint32 kitty_id;
+  /** Send kitty uploads through shared memory instead of the pty. */
+  gboolean kitty_shm;
+
+  /**
+   * Printed covers, least recently used evicted first. Keyed on geometry as
+   * well as the cover, so going back to an earlier terminal size (or cover)
+   * costs a memcpy rather than another quantize + encode.
+   */
+  UiCoverCacheEntry cover_cache[UI_COVER_CACHE_SIZE];
+  unsigned long cover_gen;
+  unsigned long cover_clock;
+
+  /** What is currently displayed on the terminal. */
+  Screen screen;
+  /** Where frames go; -1 if the caller takes them from `frame` itself. */
+  int out_fd;
+  /** Every frame is composed here, then written out in one go. */
+  FrameBuffer frame;
+  /** Reused while re-encoding printed covers. */
+  FrameBuffer scratch;
+
+  /** Track the paint times in `stats` are for; empty before the first. */
+  char paint_track[64];
+
+  struct ui_stats stats;
+};
+
+/** Set up for the terminal on stdout, and clear it. */
+void ui_setup(struct ui_ctx *ctx);
+/**
+ * Set up for `term`, taking over its term_info. Frames are only composed,
+ * never written: see ui_compose.
+ */
+void ui_init(struct ui_ctx *ctx, UiTerminal *term);
+void ui_teardown(struct ui_ctx *ctx);
+/**
+ * Draw `playing`, which may be NULL while nothing has been fetched yet.
+ * @returns 0, or -1 once the output is closed (EPIPE)
+ */
+int ui_render(struct ui_ctx *ctx, SpotifyCurrentlyPlaying *playing);
+/**
+ * Like ui_render, but leave the frame in ctx->frame instead of writing it.
+ * An empty frame means nothing changed.
+ */
+void ui_compose(struct ui_ctx *ctx, SpotifyCurrentlyPlaying *playing);
+/** Re-read the terminal geometry; the next ui_render re-lays out and redraws */
+void ui_resize(struct ui_ctx *ctx);
+/**
+ * Forget what the terminal shows, so the next frame is drawn in full (and
+ * kitty images are uploaded again), e.g. for a viewer that just attached.
+ */
+void ui_invalidate(struct ui_ctx *ctx);
+void ui_stats_print(struct ui_ctx *ctx, FILE *out);
+
+#endif /* __SNP_UI_H__ */
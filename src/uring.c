@@ -0,0 +1,210 @@
+#ifdef SNP_HAVE_IO_URING
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+// the kernel reads and writes the ring indices concurrently
+#define uring_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define uring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int wait_nr,
+                       unsigned int flags, void *arg, size_t arg_len) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags, arg,
+                 arg_len);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg,
+                          unsigned int n) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+int uring_init(Uring *ring, unsigned int entries, unsigned int flags) {
+  memset(ring, 0, sizeof(Uring));
+  struct io_uring_params p = {.flags = flags};
+  ring->fd = uring_setup(entries, &p);
+  if (ring->fd < 0)
+    return -1;
+  ring->features = p.features;
+  // timeouts are passed to io_uring_enter directly (5.11)
+  if (!(p.features & IORING_FEAT_EXT_ARG)) {
+    close(ring->fd);
+    errno = ENOSYS;
+    return -1;
+  }
+
+  ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  ring->cq_ring_len =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_len > ring->sq_ring_len)
+      ring->sq_ring_len = ring->cq_ring_len;
+    ring->cq_ring_len = 0;
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto failure;
+  if (ring->cq_ring_len) {
+    ring->cq_ring =
+        mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED)
+      goto failure;
+  } else {
+    ring->cq_ring = ring->sq_ring;
+  }
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    goto failure;
+
+  char *sq = ring->sq_ring, *cq = ring->cq_ring;
+  ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  ring->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+  ring->sq_local_tail = *ring->sq_tail;
+  // entries are always used in order, so the indirection is the identity
+  for (unsigned int i = 0; i < p.sq_entries; i++)
+    ring->sq_array[i] = i;
+
+  ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  ring->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+
+failure: {
+  int saved = errno;
+  if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+    munmap(ring->sq_ring, ring->sq_ring_len);
+  if (ring->cq_ring_len && ring->cq_ring && ring->cq_ring != MAP_FAILED)
+    munmap(ring->cq_ring, ring->cq_ring_len);
+  close(ring->fd);
+  errno = saved;
+  return -1;
+}
+}
+
+void uring_exit(Uring *ring) {
+  munmap(ring->sqes, ring->sqes_len);
+  if (ring->cq_ring_len)
+    munmap(ring->cq_ring, ring->cq_ring_len);
+  munmap(ring->sq_ring, ring->sq_ring_len);
+  close(ring->fd);
+}
+
+int uring_enable(Uring *ring) {
+  return uring_register(ring->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0);
+}
+
+int uring_submit_and_wait(Uring *ring, unsigned int wait_nr, int timeout_ms) {
+  uring_store(ring->sq_tail, ring->sq_local_tail);
+  unsigned int to_submit = ring->sq_local_tail - uring_load(ring->sq_head);
+
+  unsigned int flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+  struct __kernel_timespec ts = {timeout_ms / 1000,
+                                 (timeout_ms % 1000) * 1000000L};
+  struct io_uring_getevents_arg arg = {.ts = (unsigned long)&ts};
+  if (wait_nr && timeout_ms >= 0) {
+    flags |= IORING_ENTER_EXT_ARG;
+    return uring_enter(ring->fd, to_submit, wait_nr, flags, &arg,
+                       sizeof(arg));
+  }
+  return uring_enter(ring->fd, to_submit, wait_nr, flags, NULL, 0);
+}
+
+static unsigned int uring_sq_space(Uring *ring) {
+  return ring->sq_entries - (ring->sq_local_tail - uring_load(ring->sq_head));
+}
+
+int uring_reserve(Uring *ring, unsigned int n) {
+  if (uring_sq_space(ring) < n &&
+      (uring_submit_and_wait(ring, 0, -1) < 0 || uring_sq_space(ring) < n))
+    return -1;
+  return 0;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+  if (uring_reserve(ring, 1) < 0)
+    return NULL;
+  struct io_uring_sqe *sqe =
+      &ring->sqes[ring->sq_local_tail++ & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+  unsigned int head = *ring->cq_head;
+  if (head == uring_load(ring->cq_tail))
+    return NULL;
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+  uring_store(ring->cq_head, *ring->cq_head + 1);
+}
+
+int uring_buf_ring_init(Uring *ring, UringBufRing *bufs, unsigned short group,
+                        unsigned int entries, size_t size) {
+  memset(bufs, 0, sizeof(UringBufRing));
+  bufs->group = group;
+  bufs->entries = entries;
+  bufs->size = size;
+  bufs->br_len = entries * sizeof(struct io_uring_buf);
+  bufs->br = mmap(NULL, bufs->br_len, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufs->br == MAP_FAILED)
+    return -1;
+  bufs->bufs = malloc(entries * size);
+  if (!bufs->bufs) {
+    munmap(bufs->br, bufs->br_len);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  struct io_uring_buf_reg reg = {.ring_addr = (unsigned long)bufs->br,
+                                 .ring_entries = entries,
+                                 .bgid = group};
+  if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    int saved = errno;
+    free(bufs->bufs);
+    munmap(bufs->br, bufs->br_len);
+    errno = saved;
+    return -1;
+  }
+  for (unsigned int bid = 0; bid < entries; bid++)
+    uring_buf_ring_put(bufs, bid);
+  return 0;
+}
+
+void uring_buf_ring_free(Uring *ring, UringBufRing *bufs) {
+  struct io_uring_buf_reg reg = {.bgid = bufs->group};
+  uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  munmap(bufs->br, bufs->br_len);
+  free(bufs->bufs);
+}
+
+void uring_buf_ring_put(UringBufRing *bufs, unsigned int bid) {
+  // the tail overlays the reserved field of the first entry
+  unsigned short tail = bufs->br->tail;
+  struct io_uring_buf *buf = &bufs->br->bufs[tail & (bufs->entries - 1)];
+  buf->addr = (unsigned long)uring_buf(bufs, bid);
+  buf->len = bufs->size;
+  buf->bid = bid;
+  uring_store(&bufs->br->tail, (unsigned short)(tail + 1));
+}
+
+#endif /* SNP_HAVE_IO_URING */
@@ -0,0 +1,105 @@
+/*
+
+Just enough io_uring for the HTTP server, on the raw system calls: one ring,
+submission and completion queue access, and provided buffer rings.
+
+Only built on Linux with io_uring headers (SNP_HAVE_IO_URING); whether the
+running kernel can do what the server needs is only known at uring_init.
+
+*/
+
+#ifndef __SNP_URING_H__
+#define __SNP_URING_H__
+
+#ifdef SNP_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+typedef struct {
+  int fd;
+  unsigned int features;
+
+  unsigned int *sq_head, *sq_tail, *sq_array;
+  unsigned int sq_mask, sq_entries;
+  struct io_uring_sqe *sqes;
+  /** Entries handed out by uring_get_sqe, not yet published to the kernel. */
+  unsigned int sq_local_tail;
+
+  unsigned int *cq_head, *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_len, cq_ring_len, sqes_len;
+} Uring;
+
+/**
+ * Set up a ring of `entries` submissions with IORING_SETUP_* `flags`.
+ * @returns 0, or -1 if the kernel refuses (errno is set)
+ */
+int uring_init(Uring *ring, unsigned int entries, unsigned int flags);
+
+void uring_exit(Uring *ring);
+
+/** Start a ring set up with IORING_SETUP_R_DISABLED, from its issuer. */
+int uring_enable(Uring *ring);
+
+/**
+ * The next submission entry, zeroed; submits what is queued first if the
+ * queue is full.
+ * @returns NULL if that did not make room
+ */
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+/**
+ * Make sure the next `n` uring_get_sqe calls need not submit in between,
+ * which would cut a chain of linked entries short.
+ * @returns 0, or -1 if that did not make room
+ */
+int uring_reserve(Uring *ring, unsigned int n);
+
+/**
+ * Submit what is queued and wait for at least `wait_nr` completions, or
+ * `timeout_ms` (-1: no limit).
+ * @returns the number submitted, or -1 (errno is set; ETIME on timeout)
+ */
+int uring_submit_and_wait(Uring *ring, unsigned int wait_nr, int timeout_ms);
+
+/** The oldest unseen completion, or NULL. */
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+
+/** Hand the completion from uring_peek_cqe back to the kernel. */
+void uring_cqe_seen(Uring *ring);
+
+/** A provided buffer ring: `entries` buffers of `size` bytes each. */
+typedef struct {
+  struct io_uring_buf_ring *br;
+  size_t br_len;
+  unsigned short group;
+  unsigned int entries;
+  size_t size;
+  char *bufs;
+} UringBufRing;
+
+/**
+ * Register a ring of `entries` (a power of two) buffers as group `group`,
+ * all of them available.
+ * @returns 0, or -1 (errno is set)
+ */
+int uring_buf_ring_init(Uring *ring, UringBufRing *bufs, unsigned short group,
+                        unsigned int entries, size_t size);
+
+void uring_buf_ring_free(Uring *ring, UringBufRing *bufs);
+
+/** Buffer `bid` of `bufs`. */
+static inline char *uring_buf(UringBufRing *bufs, unsigned int bid) {
+  return bufs->bufs + (size_t)bid * bufs->size;
+}
+
+/** Make buffer `bid` available to the kernel again. */
+void uring_buf_ring_put(UringBufRing *bufs, unsigned int bid);
+
+#endif /* SNP_HAVE_IO_URING */
+
+#endif /* __SNP_URING_H__ */